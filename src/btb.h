@@ -0,0 +1,106 @@
+// btb.h
+// This file contains a set-associative branch target buffer.  It
+// remembers the target each taken branch last went to, tagged with the
+// whole branch address, and predicts that target the next time the branch
+// is seen.  A branch that misses in the BTB gets a target of 0.
+
+#ifndef BTB_H
+#define BTB_H
+
+#include "branch.h"
+#include "predictor.h"
+#include "tools.h"
+
+#define BTB_LOG_SETS	10	// 2^10 sets
+#define BTB_WAYS	4	// of 4 entries each
+
+// which entry of a full set a new branch replaces
+
+enum btb_replacement {
+	BTB_LRU,	// the one used longest ago
+	BTB_FIFO,	// the one inserted longest ago
+	BTB_RANDOM	// any of them
+};
+
+template <int LogSets = BTB_LOG_SETS, int Ways = BTB_WAYS, btb_replacement Replacement = BTB_LRU>
+class btb : public branch_predictor {
+	struct entry {
+		unsigned int address;	// branch address; the tag
+		unsigned int target;
+		unsigned int stamp;	// last use (LRU) or insertion (FIFO); 0 if empty
+	};
+
+	entry *sets;
+	unsigned int now;	// counts taken branches, for the stamps
+	entry *hit;		// where predict found the branch, or NULL
+	RandomGen rng;
+
+	entry *set_of (unsigned int address) {
+		return &sets[((address ^ (address >> LogSets)) & ((1 << LogSets) - 1)) * Ways];
+	}
+
+public:
+	branch_update u;
+	branch_info bi;
+
+	btb (void) : now(0), hit(NULL) {
+		sets = new entry[(1 << LogSets) * Ways];
+		memset (sets, 0, sizeof (entry) * (1 << LogSets) * Ways);
+		rng.seed (1);
+		u.direction_prediction (true);
+	}
+
+	~btb (void) { delete[] sets; }
+
+	void seed (unsigned int s) { rng.seed (s); }
+
+	bool checkpoint (predictor_state & s) {
+		s.array (sets, (1 << LogSets) * Ways);
+		s.value (now);
+		s.value (rng);
+		return s.complete ();
+	}
+
+	branch_update *predict (branch_info & b) {
+		bi = b;
+		entry *set = set_of (b.address);
+		hit = NULL;
+		for (int i=0; i<Ways; i++)
+			if (set[i].stamp && set[i].address == b.address) {
+				hit = &set[i];
+				break;
+			}
+		u.target_prediction (hit ? hit->target : 0);
+		return &u;
+	}
+
+	// only taken branches go anywhere worth remembering
+
+	void update (branch_update *, bool taken, unsigned int target) {
+		if (!taken) return;
+		now++;
+		if (hit) {
+			hit->target = target;
+			if (Replacement == BTB_LRU) hit->stamp = now;
+			return;
+		}
+		entry *set = set_of (bi.address), *victim = &set[0];
+		if (Replacement == BTB_RANDOM && set[Ways-1].stamp)
+			victim = &set[rng.next () % Ways];
+		else
+			for (int i=0; i<Ways; i++) {
+				if (!set[i].stamp) {
+					victim = &set[i];
+					break;
+				}
+				if (set[i].stamp < victim->stamp) victim = &set[i];
+			}
+		victim->address = bi.address;
+		victim->target = target;
+		victim->stamp = now;
+	}
+};
+
+typedef btb<> btb_predictor;
+
+#endif // BTB_H
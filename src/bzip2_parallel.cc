@@ -0,0 +1,333 @@
+// bzip2_parallel.cc
+// This file contains code for decompressing a bzip2 file a block at a time
+// on a pool of threads.  See bzip2_parallel.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <bzlib.h>
+#include <algorithm>
+
+#include "bzip2_parallel.h"
+
+// the 48-bit magic numbers that start a block and end a stream
+
+#define BLOCK_MAGIC	0x314159265359ULL
+#define EOS_MAGIC	0x177245385090ULL
+#define MAGIC_MASK	0xffffffffffffULL
+
+// append bits to a byte vector, most significant bit first like bzip2
+
+struct bit_writer {
+	std::vector<unsigned char> & v;
+	int nbits;	// bits used in the last byte; 8 if it's full
+
+	bit_writer (std::vector<unsigned char> & out) : v(out), nbits(8) {}
+
+	void put (unsigned long long x, int n) {
+		while (n--) {
+			if (nbits == 8) {
+				v.push_back (0);
+				nbits = 0;
+			}
+			if ((x >> n) & 1) v.back () |= 0x80 >> nbits;
+			nbits++;
+		}
+	}
+
+	// copy bits [start, end) of src; only called when byte-aligned
+
+	void copy (const unsigned char *src, unsigned long long start, unsigned long long end) {
+		unsigned long long n = end - start;
+		const unsigned char *p = src + start / 8;
+		int s = start % 8;
+		for (; n >= 8; n -= 8, p++)
+			v.push_back (s ? (p[0] << s) | (p[1] >> (8 - s)) : p[0]);
+		nbits = 8;
+		for (unsigned long long b = (p - src) * 8 + s; n; n--, b++)
+			put ((src[b / 8] >> (7 - b % 8)) & 1, 1);
+	}
+};
+
+// read 32 bits starting at bit offset b
+
+static unsigned int get32 (const unsigned char *src, unsigned long long b) {
+	unsigned int x = 0;
+	for (int i=0; i<32; i++, b++)
+		x = (x << 1) | ((src[b / 8] >> (7 - b % 8)) & 1);
+	return x;
+}
+
+bzip2_parallel::bzip2_parallel (void) : file(NULL), file_size(0), scanned(true), stopping(false) {}
+
+bzip2_parallel::~bzip2_parallel (void) {
+	close ();
+}
+
+// hand a block to the workers, and the consumer if it's waiting
+
+void bzip2_parallel::add_block (unsigned long long start, unsigned long long end) {
+	block k;
+	k.start = start;
+	k.end = end;
+	k.done = k.ok = k.seen = false;
+	std::lock_guard<std::mutex> g (lock);
+	blocks.push_back (k);
+	work_ready.notify_all ();
+	block_done.notify_all ();
+}
+
+// the scanning thread: find the blocks.  each one runs from its magic
+// number to the next magic number of either kind.
+
+void bzip2_parallel::find_blocks (void) {
+	unsigned long long shift = 0, nbits = file_size * 8, open_block = 0;
+	bool have_block = false;
+	for (unsigned long long b = 0; b < nbits && !stopping; b++) {
+		shift = (shift << 1) | ((file[b / 8] >> (7 - b % 8)) & 1);
+		unsigned long long m = shift & MAGIC_MASK;
+		if (b < 47 || (m != BLOCK_MAGIC && m != EOS_MAGIC)) continue;
+		unsigned long long start = b - 47;
+		{
+			std::lock_guard<std::mutex> g (lock);
+			magics.push_back (start);
+		}
+		if (have_block) add_block (open_block, start);
+		have_block = m == BLOCK_MAGIC && start >= start_bit;
+		open_block = start;
+	}
+
+	// a truncated file: let the last block run to the end and fail
+
+	if (have_block && !stopping) add_block (open_block, nbits);
+	std::lock_guard<std::mutex> g (lock);
+	scanned = true;
+	work_ready.notify_all ();
+	block_done.notify_all ();
+}
+
+// decompress the block(s) in bits [start, end) of the file by wrapping
+// them up as a bzip2 stream of their own.  a stream with one block has
+// that block's CRC as its combined CRC.
+
+bool bzip2_parallel::decompress (unsigned long long start, unsigned long long end, std::vector<unsigned char> & out) {
+	std::vector<unsigned char> in;
+	bit_writer w (in);
+
+	in.reserve ((end - start) / 8 + 20);
+
+	// always claim 900KB blocks; the level only bounds the block size
+
+	in.push_back ('B');
+	in.push_back ('Z');
+	in.push_back ('h');
+	in.push_back ('9');
+	w.copy (file, start, end);
+	w.put (EOS_MAGIC, 48);
+	w.put (get32 (file, start + 48), 32);
+
+	bz_stream bz;
+	memset (&bz, 0, sizeof (bz));
+	if (BZ2_bzDecompressInit (&bz, 0, 0) != BZ_OK) return false;
+	bz.next_in = (char *) in.data ();
+	bz.avail_in = in.size ();
+	out.clear ();
+	int err;
+	do {
+		size_t have = out.size ();
+		out.resize (have + (1 << 20));
+		bz.next_out = (char *) out.data () + have;
+		bz.avail_out = 1 << 20;
+		err = BZ2_bzDecompress (&bz);
+		out.resize (out.size () - bz.avail_out);
+	} while (err == BZ_OK && (bz.avail_in > 0 || bz.avail_out == 0));
+	BZ2_bzDecompressEnd (&bz);
+	return err == BZ_STREAM_END;
+}
+
+// a worker thread: decompress blocks in order, staying within the window
+
+void bzip2_parallel::work (void) {
+	std::unique_lock<std::mutex> l (lock);
+	for (;;) {
+		work_ready.wait (l, [this] { 
+			return stopping || (next_block < blocks.size () && next_block < cur_block + window); 
+		});
+		if (stopping) return;
+		size_t i = next_block++;
+		unsigned long long start = blocks[i].start, end = blocks[i].end;
+		std::vector<unsigned char> out;
+		l.unlock ();
+		bool ok = decompress (start, end, out);
+		l.lock ();
+		blocks[i].out.swap (out);
+		blocks[i].ok = ok;
+		blocks[i].done = true;
+		block_done.notify_all ();
+	}
+}
+
+bool bzip2_parallel::open (const char *fname, int threads, unsigned long long start, unsigned long long start_pos) {
+	close ();
+	int fd = ::open (fname, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	void *p = MAP_FAILED;
+	if (fstat (fd, &st) == 0 && st.st_size > 0)
+		p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close (fd);
+	if (p == MAP_FAILED) return false;
+	madvise (p, st.st_size, MADV_SEQUENTIAL);
+	file = (const unsigned char *) p;
+	file_size = st.st_size;
+
+	history.clear ();
+	out_pos = start_pos;
+	next_block = cur_block = cur_pos = 0;
+	window = 2 * threads;
+	start_bit = start;
+	scanned = false;
+	stopping = false;
+	scanner = std::thread (&bzip2_parallel::find_blocks, this);
+	for (int i=0; i<threads; i++)
+		workers.push_back (std::thread (&bzip2_parallel::work, this));
+
+	// wait for the first block, or for there to be none.  if we were
+	// given a start_bit, the block has to start right there.
+
+	std::unique_lock<std::mutex> l (lock);
+	block_done.wait (l, [this] { return scanned || !blocks.empty (); });
+	if (blocks.empty () || (start_bit && blocks[0].start != start_bit)) {
+		l.unlock ();
+		close ();
+		return false;
+	}
+	return true;
+}
+
+// move on to the next block once it's decompressed.  a block that failed
+// most likely ends at a magic number that turned up by chance inside it, so
+// it's decoded again from its start running on to the next magic number,
+// gluing on the next block if that's where one starts, until it works or
+// the file runs out.  returns false at the end.  called with the lock held.
+
+bool bzip2_parallel::next_ready_block (void) {
+	std::unique_lock<std::mutex> l (lock, std::adopt_lock);
+	for (;;) {
+		block_done.wait (l, [this] { return scanned || cur_block < blocks.size (); });
+		if (cur_block >= blocks.size ()) {
+			l.release ();
+			return false;
+		}
+		block & k = blocks[cur_block];
+		block_done.wait (l, [&k] { return k.done; });
+		unsigned long long nbits = file_size * 8;
+		if (k.ok || k.end >= nbits) break;
+
+		// whether another block follows, and every magic number up to
+		// its start, is only known once the scan has got that far
+
+		block_done.wait (l, [this] { return scanned || cur_block + 1 < blocks.size (); });
+		if (cur_block + 1 == blocks.size () || blocks[cur_block + 1].start > k.end) {
+
+			// it ends at an end-of-stream magic number; no other
+			// block overlaps the bits up to the next one
+
+			auto m = std::upper_bound (magics.begin (), magics.end (), k.end);
+			k.end = m == magics.end () ? nbits : *m;
+			l.unlock ();
+			k.ok = decompress (k.start, k.end, k.out);
+			l.lock ();
+			continue;
+		}
+
+		// the next block must finish first so no worker is using it
+
+		block & k2 = blocks[cur_block + 1];
+		block_done.wait (l, [&k2] { return k2.done; });
+		k2.start = k.start;
+		l.unlock ();
+		k2.ok = decompress (k2.start, k2.end, k2.out);
+		l.lock ();
+		k.out.clear ();
+		k.out.shrink_to_fit ();
+		cur_block++;
+		work_ready.notify_all ();
+	}
+	if (!blocks[cur_block].ok) {
+		fprintf (stderr, "bzip2 error in block at bit %llu\n", blocks[cur_block].start);
+		exit (1);
+	}
+	l.release ();
+	return true;
+}
+
+size_t bzip2_parallel::read (unsigned char *p, size_t n) {
+	std::lock_guard<std::mutex> g (lock);
+	size_t got = 0;
+	while (got < n) {
+		if (cur_block >= blocks.size () || !blocks[cur_block].done || !blocks[cur_block].ok) {
+			if (!next_ready_block ()) break;
+			continue;
+		}
+		block & k = blocks[cur_block];
+		if (!k.seen) {
+			history.push_back (std::make_pair (out_pos, k.start));
+			k.seen = true;
+		}
+		size_t m = std::min (n - got, k.out.size () - cur_pos);
+		memcpy (p + got, k.out.data () + cur_pos, m);
+		got += m;
+		cur_pos += m;
+		out_pos += m;
+		if (cur_pos == k.out.size ()) {
+
+			// done with this block; let the workers move ahead
+
+			std::vector<unsigned char> ().swap (k.out);
+			cur_block++;
+			cur_pos = 0;
+			work_ready.notify_all ();
+		}
+	}
+	return got;
+}
+
+bool bzip2_parallel::locate (unsigned long long pos, unsigned long long *bit, unsigned long long *skip) {
+	std::lock_guard<std::mutex> g (lock);
+	if (history.empty () || pos < history[0].first || pos > out_pos) return false;
+
+	// the last block that starts at or before pos
+
+	size_t lo = 0, hi = history.size ();
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (history[mid].first <= pos) lo = mid; else hi = mid;
+	}
+	*bit = history[lo].second;
+	*skip = pos - history[lo].first;
+	return true;
+}
+
+void bzip2_parallel::close (void) {
+	{
+		std::lock_guard<std::mutex> g (lock);
+		stopping = true;
+	}
+	work_ready.notify_all ();
+	if (scanner.joinable ()) scanner.join ();
+	for (auto & t : workers) t.join ();
+	workers.clear ();
+	blocks.clear ();
+	magics.clear ();
+	history.clear ();
+	if (file) munmap ((void *) file, file_size);
+	file = NULL;
+	file_size = 0;
+	scanned = true;
+	stopping = false;
+}
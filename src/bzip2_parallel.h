@@ -0,0 +1,99 @@
+// bzip2_parallel.h
+// This file declares bzip2_parallel, which decompresses a bzip2 file on a
+// pool of threads.  A bzip2 stream is a sequence of blocks, each holding
+// up to 900KB of input, that can be decompressed independently.  Blocks
+// start with a 48-bit magic number that isn't byte-aligned, so a scanning
+// thread finds them by going through the mapped file bit by bit and hands
+// each one to the worker threads as soon as it has found where the block
+// ends.  The workers wrap each block up as a little one-block bzip2 stream
+// for libbz2, and the consumer reads the decompressed bytes back in order.
+//
+// Either magic number can also turn up by chance inside compressed data.
+// A block cut short that way fails its CRC check, so when a block doesn't
+// decompress we try again running it on to the next magic number.
+
+#ifndef BZIP2_PARALLEL_H
+#define BZIP2_PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class bzip2_parallel {
+public:
+	bzip2_parallel (void);
+	~bzip2_parallel (void);
+
+	// map the bzip2 file fname and start finding its blocks and
+	// decompressing them on threads threads.  returns false if it can't
+	// be read or has no blocks.
+	// to start part of the way through the file, start_bit gives the
+	// start of a block (see locate) and start_pos the offset in the
+	// decompressed data where that block begins; it returns false if
+	// no block starts there.
+
+	bool open (const char *fname, int threads, unsigned long long start_bit = 0, unsigned long long start_pos = 0);
+
+	// find the block holding offset pos in the decompressed data, which
+	// must be in a block read so far.  sets *bit to the block's start
+	// in the file and *skip to how far pos is into the block.
+
+	bool locate (unsigned long long pos, unsigned long long *bit, unsigned long long *skip);
+
+	// copy up to n decompressed bytes to p; returns how many, 0 at the
+	// end of the file.  exits if the file is corrupt.
+
+	size_t read (unsigned char *p, size_t n);
+
+	// stop the threads and free everything
+
+	void close (void);
+
+private:
+	struct block {
+		unsigned long long start, end;	// bit offsets in the file
+		std::vector<unsigned char> out;	// decompressed bytes
+		bool done, ok, seen;
+	};
+
+	// for each block read so far, its offset in the decompressed data
+	// and its start in the file
+
+	std::vector<std::pair<unsigned long long, unsigned long long> > history;
+	unsigned long long out_pos;
+
+	const unsigned char *file;	// the compressed file, mapped
+	size_t file_size;
+	unsigned long long start_bit;	// blocks before this one are skipped
+
+	// the blocks found so far, in a deque so that adding one doesn't
+	// move the ones workers are using, and where every magic number of
+	// either kind found so far starts.  scanned is set at the end.
+
+	std::deque<block> blocks;
+	std::vector<unsigned long long> magics;
+	bool scanned;
+
+	// the next block a worker should start on, the one the consumer is
+	// reading from, and where it is in that block.  workers stay
+	// within window blocks of the consumer so memory stays bounded.
+
+	size_t next_block, cur_block, cur_pos, window;
+
+	std::mutex lock;
+	std::condition_variable work_ready, block_done;
+	std::thread scanner;
+	std::vector<std::thread> workers;
+	std::atomic<bool> stopping;
+
+	void find_blocks (void);
+	void add_block (unsigned long long start, unsigned long long end);
+	bool decompress (unsigned long long start, unsigned long long end, std::vector<unsigned char> & out);
+	void work (void);
+	bool next_ready_block (void);
+};
+
+#endif // BZIP2_PARALLEL_H
@@ -0,0 +1,116 @@
+// checkpoint.cc
+// This file contains code for writing and reading predictor checkpoints.
+// See checkpoint.h for the format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "trace_cache.h"
+#include "checkpoint.h"
+
+void predictor_checkpoint_name (char *out, size_t n, const char *dir, const char *fname) {
+	trace_file_derived_name (out, n, dir, fname, ".pstate");
+}
+
+static bool make_header (predictor_checkpoint_header *h, const char *source) {
+	memset (h, 0, sizeof (*h));
+	memcpy (h->magic, PREDICTOR_CHECKPOINT_MAGIC, sizeof (h->magic));
+	h->version = PREDICTOR_CHECKPOINT_VERSION;
+	return trace_file_checksum (source, &h->source_size, &h->source_crc);
+}
+
+bool save_predictor_checkpoint (const char *cname, const char *source, unsigned long long branch,
+	const std::vector<std::string> & names, const std::vector<predictor_state> & states) {
+	predictor_checkpoint_header h;
+
+	if (!make_header (&h, source)) return false;
+	h.branch = branch;
+	h.count = states.size ();
+
+	// write to a temporary file and rename it into place, so a failed
+	// write never leaves a partial checkpoint behind
+
+	char tmpname[1100];
+	temporary_file_name (tmpname, sizeof (tmpname), cname);
+	FILE *f = fopen (tmpname, "wb");
+	if (!f) {
+		perror (tmpname);
+		return false;
+	}
+	bool ok = fwrite (&h, sizeof (h), 1, f) == 1;
+	for (size_t i=0; ok && i<states.size (); i++) {
+		char name[PREDICTOR_NAME_SIZE];
+		memset (name, 0, sizeof (name));
+		strncpy (name, names[i].c_str (), sizeof (name) - 1);
+		unsigned long long size = states[i].data.size ();
+		ok = fwrite (name, sizeof (name), 1, f) == 1
+		  && fwrite (&size, sizeof (size), 1, f) == 1
+		  && fwrite (states[i].data.data (), 1, size, f) == size;
+	}
+	if (fclose (f) != 0) ok = false;
+	if (!ok || rename (tmpname, cname) != 0) {
+		perror (cname);
+		unlink (tmpname);
+		return false;
+	}
+	return true;
+}
+
+bool load_predictor_checkpoint (const char *cname, const char *source, unsigned long long *branch,
+	std::vector<std::string> & names, std::vector<predictor_state> & states) {
+	predictor_checkpoint_header want, h;
+
+	FILE *f = fopen (cname, "rb");
+	if (!f) return false;
+	if (fread (&h, sizeof (h), 1, f) != 1 || !make_header (&want, source)) {
+		fclose (f);
+		return false;
+	}
+	want.branch = h.branch;
+	want.count = h.count;
+	if (memcmp (&want, &h, sizeof (h)) != 0) {
+		fprintf (stderr, "%s: predictor checkpoint is for another trace or version\n", cname);
+		fclose (f);
+		return false;
+	}
+
+	// don't believe the count and sizes further than the file goes, so a
+	// corrupt checkpoint can't make us allocate more than it holds
+
+	struct stat st;
+	unsigned long long left = 0;
+	const unsigned long long entry = PREDICTOR_NAME_SIZE + sizeof (unsigned long long);
+	if (fstat (fileno (f), &st) == 0 && (unsigned long long) st.st_size > sizeof (h))
+		left = st.st_size - sizeof (h);
+	names.clear ();
+	states.clear ();
+	if (h.count > left / entry) {
+		fprintf (stderr, "%s: truncated predictor checkpoint\n", cname);
+		fclose (f);
+		return false;
+	}
+	states.assign (h.count, predictor_state (true));
+	size_t loaded = 0;
+	for (size_t i=0; i<h.count; i++) {
+		char name[PREDICTOR_NAME_SIZE];
+		unsigned long long size;
+		if (fread (name, sizeof (name), 1, f) != 1 || fread (&size, sizeof (size), 1, f) != 1
+		 || left < entry || size > left - entry) break;
+		left -= entry + size;
+		name[sizeof (name) - 1] = 0;
+		names.push_back (name);
+		states[i].data.resize (size);
+		if (fread (states[i].data.data (), 1, size, f) != size) break;
+		loaded++;
+	}
+	fclose (f);
+	if (loaded != h.count) {
+		fprintf (stderr, "%s: truncated predictor checkpoint\n", cname);
+		return false;
+	}
+	*branch = h.branch;
+	return true;
+}
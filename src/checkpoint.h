@@ -0,0 +1,91 @@
+// checkpoint.h
+// This file declares predictor checkpoints.  Warming a predictor up on
+// the start of a trace costs as much as measuring it, and sweeps do it
+// again for every run.  A checkpoint file holds the state of each of the
+// predictors a run of predict simulated, taken after its last branch
+// (predict -C), so a later run can load it and start measuring there
+// without warming up again (predict -L).
+//
+// Like the caches and the index, the header records the size and CRC-32
+// of the trace so a checkpoint can't be used with a different trace.  It
+// also records the branch the state was taken after; a run that loads the
+// checkpoint has to start its slice there, and seeks to it with the
+// trace's index (see trace_index.h).
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define PREDICTOR_CHECKPOINT_MAGIC	"CBPPSTAT"
+#define PREDICTOR_CHECKPOINT_VERSION	1	// bump when a predictor's state changes
+
+#define PREDICTOR_NAME_SIZE	32
+
+struct predictor_checkpoint_header {
+	char		magic[8];	// PREDICTOR_CHECKPOINT_MAGIC
+	unsigned int	version,	// PREDICTOR_CHECKPOINT_VERSION
+			source_crc;	// CRC-32 of the trace file
+	unsigned long long source_size,	// size of the trace file in bytes
+			branch,		// branches simulated before the state was taken
+			count;		// number of predictors that follow
+};
+
+// each predictor is stored as its name in PREDICTOR_NAME_SIZE bytes, the
+// size of its state, and the state
+
+// The state of one predictor on its way into or out of a checkpoint.  A
+// predictor's checkpoint function passes each piece of its state to
+// value() or array() in a fixed order; saving appends them to data, and
+// restoring copies them back out in the same order.  Only plain data can
+// go in, and a checkpoint is only good for a predictor built the same way.
+
+class predictor_state {
+	bool restoring;
+	size_t pos;	// how much of data restoring has used
+
+public:
+	std::vector<unsigned char> data;
+	bool ok;	// false if restoring ran off the end of data
+
+	predictor_state (bool restore = false) : restoring(restore), pos(0), ok(true) {}
+
+	void bytes (void *p, size_t n) {
+		if (!restoring)
+			data.insert (data.end (), (unsigned char *) p, (unsigned char *) p + n);
+		else if (ok && pos + n <= data.size ()) {
+			memcpy (p, &data[pos], n);
+			pos += n;
+		} else
+			ok = false;
+	}
+
+	template <class T> void value (T & v) { bytes (&v, sizeof (v)); }
+	template <class T> void array (T *a, size_t n) { bytes (a, n * sizeof (T)); }
+
+	// restoring used exactly the state that was saved
+	bool complete (void) const { return ok && (!restoring || pos == data.size ()); }
+};
+
+// make the name of the checkpoint file in dir for trace file fname
+
+void predictor_checkpoint_name (char *out, size_t n, const char *dir, const char *fname);
+
+// write the states of the named predictors, taken after branch branches
+// of trace file source, to the checkpoint file cname.  returns false if
+// it can't be written.
+
+bool save_predictor_checkpoint (const char *cname, const char *source, unsigned long long branch,
+	const std::vector<std::string> & names, const std::vector<predictor_state> & states);
+
+// read the checkpoint file cname, which has to be for trace file source,
+// setting *branch and the names and states (ready to restore) of its
+// predictors.  returns false if there isn't a current one.
+
+bool load_predictor_checkpoint (const char *cname, const char *source, unsigned long long *branch,
+	std::vector<std::string> & names, std::vector<predictor_state> & states);
+
+#endif // CHECKPOINT_H
@@ -1,30 +1,134 @@
 // Predictor 1: gshare
 
-class my_update : public branch_update {
+#ifndef GSHARE_H
+#define GSHARE_H
+
+#include <string.h>
+#include "checkpoint.h"
+
+// A table of 2-bit counters, packed four to a byte, indexed by some mix
+// of the branch address and the global history.  The table size, the
+// history length and the mix are template parameters:
+//
+//	CT_GSHARE	address xor history, the history in the high bits
+//	CT_GSELECT	the low address bits with the history appended
+//	CT_BIMODAL	the address alone
+//	CT_AGREE	as gshare, but the counters say whether the branch
+//			agrees with a bias bit set by its first outcome
+//			(Sprangle et al.), so branches that share a counter
+//			are less likely to fight over it
+
+#define GSHARE_TABLE_BITS	15
+#define GSHARE_HISTORY_BITS	15
+#define AGREE_BIAS_BITS		12	// 2^12 bias bits, indexed by address
+
+enum counter_hash {
+	CT_GSHARE,
+	CT_GSELECT,
+	CT_BIMODAL,
+	CT_AGREE
+};
+
+class gshare_update : public branch_update {
 public:
 	unsigned int index;
 };
 
-class my_predictor : public branch_predictor {
+// 2-bit counters packed four to a byte
+
+class counter_array {
+	unsigned char *tab;
+	unsigned int bytes;
+
+public:
+	counter_array (int log_size, int init) : bytes (((1u << log_size) + 3) / 4) {
+		tab = new unsigned char[bytes];
+		memset (tab, init * 0x55, bytes);
+	}
+
+	~counter_array (void) { delete[] tab; }
+
+	void checkpoint (predictor_state & s) { s.array (tab, bytes); }
+
+	int get (unsigned int i) const {
+		return (tab[i >> 2] >> ((i & 3) * 2)) & 3;
+	}
+
+	void set (unsigned int i, int c) {
+		int shift = (i & 3) * 2;
+		tab[i >> 2] = (tab[i >> 2] & ~(3 << shift)) | (c << shift);
+	}
+
+	// saturating, without branches: whether a counter is at its limit is
+	// as hard to predict as the branches themselves
+	void train (unsigned int i, bool up) {
+		unsigned char &t = tab[i >> 2];
+		int shift = (i & 3) * 2;
+		int c = (t >> shift) & 3;
+		int n = up ? c + (c < 3) : c - (c > 0);
+		t ^= (c ^ n) << shift;
+	}
+};
+
+template <int TableBits = GSHARE_TABLE_BITS, int HistoryBits = GSHARE_HISTORY_BITS, counter_hash Hash = CT_GSHARE>
+class counter_table_predictor : public branch_predictor {
+	static_assert (TableBits >= 1 && TableBits <= 30, "bad table size");
+	static_assert (HistoryBits >= 0 && HistoryBits <= TableBits && HistoryBits < 32,
+		"the history has to fit in the index");
+
+	// agree counters start weakly agreeing, the others strongly not taken
+	counter_array tab;
+
+	// bias of each branch for CT_AGREE: 0 if not seen yet, otherwise 2
+	// plus the direction of its first outcome
+	counter_array bias;
+
+	static unsigned int bias_index (unsigned int address) {
+		return address & ((1 << AGREE_BIAS_BITS) - 1);
+	}
+
 public:
-	#define HISTORY_LENGTH	15
-	#define TABLE_BITS	15
-	my_update u;
+	// Bits of state: the counters, the history and, for CT_AGREE, the
+	// bias bits and whether they have been set
+	static constexpr long StorageBits = (1L << TableBits) * 2 + HistoryBits
+		+ (Hash == CT_AGREE ? (1L << AGREE_BIAS_BITS) * 2 : 0);
+
+	gshare_update u;
 	branch_info bi;
 	unsigned int history;
-	unsigned char tab[1<<TABLE_BITS];
 
-	my_predictor (void) : history(0) { 
-		memset (tab, 0, sizeof (tab));
+	counter_table_predictor (void) : tab (TableBits, Hash == CT_AGREE ? 2 : 0),
+		bias (Hash == CT_AGREE ? AGREE_BIAS_BITS : 0, 0), history(0) {}
+
+	bool checkpoint (predictor_state & s) {
+		tab.checkpoint (s);
+		if (Hash == CT_AGREE) bias.checkpoint (s);
+		s.value (history);
+		return s.complete ();
 	}
 
 	branch_update *predict (branch_info & b) {
 		bi = b;
 		if (b.br_flags & BR_CONDITIONAL) {
-			u.index = 
-				  (history << (TABLE_BITS - HISTORY_LENGTH)) 
-				^ (b.address & ((1<<TABLE_BITS)-1));			
-			u.direction_prediction (tab[u.index] >> 1);
+			unsigned int address = b.address & ((1 << TableBits) - 1);
+			switch (Hash) {
+			case CT_GSELECT:
+				u.index = (address << HistoryBits) ^ history;
+				break;
+			case CT_BIMODAL:
+				u.index = address;
+				break;
+			default:
+				u.index = (history << (TableBits - HistoryBits)) ^ address;
+			}
+			u.index &= (1 << TableBits) - 1;
+			bool taken = tab.get (u.index) >> 1;
+			if (Hash == CT_AGREE) {
+				// a branch not seen yet is assumed to be biased taken
+				int dir = bias.get (bias_index (b.address));
+				taken = taken == (!dir || (dir & 1));
+			}
+			u.direction_prediction (taken);
 		} else {
 			u.direction_prediction (true);
 		}
@@ -34,15 +138,30 @@ public:
 
 	void update (branch_update *u, bool taken, unsigned int target) {
 		if (bi.br_flags & BR_CONDITIONAL) {
-			unsigned char *c = &tab[((my_update*)u)->index];
-			if (taken) {
-				if (*c < 3) (*c)++;
-			} else {
-				if (*c > 0) (*c)--;
+			unsigned int index = ((gshare_update*)u)->index;
+			if (Hash == CT_AGREE) {
+				unsigned int i = bias_index (bi.address);
+				int dir = bias.get (i);
+				if (!dir) {
+					dir = 2 | taken;
+					bias.set (i, dir);
+				}
+				tab.train (index, taken == (dir & 1));
+			} else
+				tab.train (index, taken);
+			if (HistoryBits) {
+				history <<= 1;
+				history |= taken;
+				history &= (1u << HistoryBits) - 1;
 			}
-			history <<= 1;
-			history |= taken;
-			history &= (1<<HISTORY_LENGTH)-1;
 		}
 	}
-};
\ No newline at end of file
+};
+
+typedef counter_table_predictor<> gshare_predictor;
+typedef counter_table_predictor<20, 20> gshare20_predictor;		// 256KB
+typedef counter_table_predictor<15, 8, CT_GSELECT> gselect_predictor;
+typedef counter_table_predictor<15, 0, CT_BIMODAL> bimodal_predictor;
+typedef counter_table_predictor<15, 15, CT_AGREE> agree_predictor;
+
+#endif // GSHARE_H
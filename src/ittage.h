@@ -1,7 +1,9 @@
 // Predictor 3: ITTAGE
 
+#ifndef ITTAGE_H
+#define ITTAGE_H
+
 #include <cstdint>
-#include <bitset>
 #include <algorithm>
 #include "tools.h"
 
@@ -12,34 +14,75 @@
 #define U_CTR_MAX			    3	// 2bit counter (as per paper); 00 ... 11;
 #define C_CTR_MAX			    3	// 2bit counter (as per paper); 00 ... 11;
 
-// Entry in an ITTAGE component
+#define ITTAGE_TAG_BITS         9   // Bits of tag in an ITTAGE entry
+
+// Entry in an ITTAGE component.  As with TAGE, the predictor only uses the
+// get/set functions, so the layout is a template parameter of
+// basic_ittage_predictor.
+
+// One word per field; 16 bytes
 struct IttageEntry {
     unsigned int target;  // Prediction target address
     UINT32 tag;           // Unique tag
     INT32 c;              // 2bit confidence counter
     INT32 u;              // 2bit useful counter
+
+    unsigned int getTarget() const { return target; }
+    UINT32 getTag() const { return tag; }
+    INT32 getC() const { return c; }
+    INT32 getU() const { return u; }
+    void setTarget(unsigned int v) { target = v; }
+    void setTag(UINT32 v) { tag = v; }
+    void setC(INT32 v) { c = v; }
+    void setU(INT32 v) { u = v; }
+};
+
+// The target, then c, u and a TagBits-bit tag packed into a second word
+// from the low bits up; 8 bytes
+template <int TagBits>
+struct PackedIttageEntry {
+    static_assert(2 + 2 + TagBits <= 32, "tag doesn't fit in the entry");
+    unsigned int target;
+    UINT32 bits;
+
+    unsigned int getTarget() const { return target; }
+    INT32 getC() const { return bits & 3; }
+    INT32 getU() const { return (bits >> 2) & 3; }
+    UINT32 getTag() const { return bits >> 4; }
+    void setTarget(unsigned int v) { target = v; }
+    void setC(INT32 v) { bits = (bits & ~3u) | (v & 3); }
+    void setU(INT32 v) { bits = (bits & ~(3u << 2)) | ((v & 3) << 2); }
+    void setTag(UINT32 v) { bits = (bits & 15) | ((v & ((1u << TagBits) - 1)) << 4); }
 };
 
-class ittage_predictor : public branch_predictor {
+template <class Entry>
+class basic_ittage_predictor : public branch_predictor {
+public:
+    typedef HistoryProvider<> History;
+
 private:
-	// Histories
-	std::bitset<GHIST_SIZE> GHR;    // Global history register
-	int PHR;				        // 16bit path history
+	// Histories; our own unless a composite predictor shares its own
+	History ownHistory;
+	History *history;
+	bool sharedHistory;
+
+	// Only look up and train the tables on indirect branches
+	bool indirectOnly;
 	
 	// Bimodal Base Predictor
 	unsigned int *bimodal;		// Pattern history table (pht)
 	UINT32 numBimodalEntries;	// Total entries in pht 
 	
 	// Tagged Predictors
-	IttageEntry *ittagePred[NUM_ITTAGE_TABLES];	// ITTAGE tables; T[4]
+	Entry *ittagePred[NUM_ITTAGE_TABLES];		// ITTAGE tables; T[4]
 	// UINT32 geometric[NUM_ITTAGE_TABLES];		// Geometric history length of T[i]
 	UINT32 numTagPredEntries;				    // Total entries in TAGE table
 	UINT32 index[NUM_ITTAGE_TABLES];		    // Calculated index for T[i]
 	UINT32 tag[NUM_ITTAGE_TABLES];			    // Calculated tag for that index in T[i]
 	
-	// Compressed Buffers
-	FoldedHist indexComp[NUM_ITTAGE_TABLES];
-	FoldedHist tagComp[2][NUM_ITTAGE_TABLES]; 
+	// Compressed histories, kept in history
+	const UINT32 *indexComp[NUM_ITTAGE_TABLES];
+	const UINT32 *tagComp[2][NUM_ITTAGE_TABLES];
 
 	// Predictions
 	unsigned int providerPred;  // Prediction of the provider component
@@ -48,15 +91,23 @@ private:
 	int altComp;			    // Alternate component
 	INT32 altBetterCount;	    // Times that the alternate prediction was better
 
+	// Random numbers for choosing where to allocate
+	RandomGen rng;
+
 	// Clock for resetting
 	UINT32 clock;
-	int clock_flip;
+	UsefulAging<Entry, NUM_ITTAGE_TABLES> aging;
 
 public:
 	branch_update u;
 	branch_info bi;
 
-	ittage_predictor (void) { 
+	// Subscribe to shared, which the caller updates, if given.  On its own
+	// ITTAGE updates its history on every branch with the LSB of the target.
+	// With indirect_only the tables are left alone on other branches, whose
+	// targets nobody asks ITTAGE for; they still go into the history.
+	basic_ittage_predictor (History *shared = 0, bool indirect_only = false) :
+        history(shared ? shared : &ownHistory), sharedHistory(shared != 0), indirectOnly(indirect_only) { 
 
         // Initialize bimodal predictor
         numBimodalEntries = (1 << BIMODAL_LOG_SIZE);
@@ -69,13 +120,13 @@ public:
         numTagPredEntries = (1 << ITTAGE_COMP_LOG_SIZE);
     
         for(UINT32 i = 0; i < NUM_ITTAGE_TABLES; i++) {
-            ittagePred[i] = new IttageEntry[numTagPredEntries];
+            ittagePred[i] = new Entry[numTagPredEntries];
     
             for(UINT32 j = 0; j < numTagPredEntries; j++) {
-                ittagePred[i][j].target = 0; 
-                ittagePred[i][j].tag = 0;     
-                ittagePred[i][j].u = 0;
-                ittagePred[i][j].c = 0;
+                ittagePred[i][j].setTarget(0); 
+                ittagePred[i][j].setTag(0);     
+                ittagePred[i][j].setU(0);
+                ittagePred[i][j].setC(0);
             }
         }
     
@@ -90,20 +141,14 @@ public:
         UINT32 geometric[NUM_ITTAGE_TABLES] = { 128, 32, 8, 2 };
     
         // Initialize compressed buffers for indices 
-        for(int i = 0; i < NUM_ITTAGE_TABLES; i++) {
-            indexComp[i].geomLength = geometric[i];
-            indexComp[i].targetLength = ITTAGE_COMP_LOG_SIZE;
-            indexComp[i].compHist = 0;
-        }
+        for(int i = 0; i < NUM_ITTAGE_TABLES; i++)
+            indexComp[i] = history->subscribe(geometric[i], ITTAGE_COMP_LOG_SIZE);
     
         // Initialize compressed buffers for tags
         // From PPM paper, tagComp[0] has 8bits and tagComp[1] has 7 bits
         for(int j = 0; j < 2 ; j++) {
-            for(int i = 0; i < NUM_ITTAGE_TABLES; i++) {
-                tagComp[j][i].geomLength = geometric[i];
-                tagComp[j][i].targetLength = (j == 0) ? 8 : 7;
-                tagComp[j][i].compHist = 0;
-            }   
+            for(int i = 0; i < NUM_ITTAGE_TABLES; i++)
+                tagComp[j][i] = history->subscribe(geometric[i], (j == 0) ? 8 : 7);
         }
     
         // Predictions banks and values 
@@ -113,56 +158,72 @@ public:
         altComp = NUM_ITTAGE_TABLES;
             
         clock = 0;
-        clock_flip = 1;
-        PHR = 0;
-        GHR.reset();
+        aging.init(ittagePred, numTagPredEntries);
         altBetterCount = 8;
+        rng.seed(1);
     }    
 
+	void seed (unsigned int s) { rng.seed(s); }
+
+	// As for TAGE: the tables, counters and clocks, and the history if
+	// it's our own
+	bool checkpoint (predictor_state & s) {
+		s.array(bimodal, numBimodalEntries);
+		for (int i = 0; i < NUM_ITTAGE_TABLES; i++)
+			s.array(ittagePred[i], numTagPredEntries);
+		s.value(altBetterCount);
+		s.value(rng);
+		s.value(clock);
+		aging.checkpoint(s);
+		if (!sharedHistory)
+			history->checkpoint(s);
+		return s.complete();
+	}
+
 	branch_update *predict (branch_info & b) {
         bi = b;
 
+        if (indirectOnly && !(b.br_flags & BR_INDIRECT)) {
+            u.target_prediction(0);
+            return &u;
+        }
+
         // Base prediction
         UINT32 bimodalIndex = b.address % numBimodalEntries;
         unsigned int baseTarget = bimodal[bimodalIndex];
 
         // Compute tag according to PPM paper: pc[9:0] ⊕ CSR1 ⊕ (CSR2 << 1)
         for (int i = 0; i < NUM_ITTAGE_TABLES; i++) {
-            tag[i] = b.address ^ tagComp[0][i].compHist ^ (tagComp[1][i].compHist << 1);
-            tag[i] &= ((1 << 9) - 1);
+            tag[i] = b.address ^ *tagComp[0][i] ^ (*tagComp[1][i] << 1);
+            tag[i] &= ((1 << ITTAGE_TAG_BITS) - 1);
         }
 
         // Compute index for each table according to PPM paper: pc[9:0] ⊕ pc[19:10] ⊕ ghist ⊕ phist
-        index[0] = b.address ^ (b.address >> ITTAGE_COMP_LOG_SIZE) ^ indexComp[0].compHist ^ PHR ^ (PHR >> ITTAGE_COMP_LOG_SIZE);
-        index[1] = b.address ^ (b.address >> (ITTAGE_COMP_LOG_SIZE - 1)) ^ indexComp[1].compHist ^ (PHR);
-        index[2] = b.address ^ (b.address >> (ITTAGE_COMP_LOG_SIZE - 2)) ^ indexComp[2].compHist ^ (PHR & 31);
-        index[3] = b.address ^ (b.address >> (ITTAGE_COMP_LOG_SIZE - 3)) ^ indexComp[3].compHist ^ (PHR & 7);
+        int PHR = history->PHR;
+        index[0] = b.address ^ (b.address >> ITTAGE_COMP_LOG_SIZE) ^ *indexComp[0] ^ PHR ^ (PHR >> ITTAGE_COMP_LOG_SIZE);
+        index[1] = b.address ^ (b.address >> (ITTAGE_COMP_LOG_SIZE - 1)) ^ *indexComp[1] ^ (PHR);
+        index[2] = b.address ^ (b.address >> (ITTAGE_COMP_LOG_SIZE - 2)) ^ *indexComp[2] ^ (PHR & 31);
+        index[3] = b.address ^ (b.address >> (ITTAGE_COMP_LOG_SIZE - 3)) ^ *indexComp[3] ^ (PHR & 7);
 
         UINT32 index_mask = ((1 << ITTAGE_COMP_LOG_SIZE) - 1);
-        for (int i = 0; i < NUM_ITTAGE_TABLES; i++)
+        for (int i = 0; i < NUM_ITTAGE_TABLES; i++) {
             index[i] &= index_mask;
+            aging.sync(i, index[i]);    // catch up on resets before using u
+        }
 
         // Set the provider and alternate predictions
         providerPred = -1;
         altPred = -1;
-        providerComp = NUM_ITTAGE_TABLES;
-        altComp = NUM_ITTAGE_TABLES;
-        
-        // See if any tags match for the provider component; T0 would be best
-        for (int i = 0; i < NUM_ITTAGE_TABLES; i++) {
-            if (ittagePred[i][index[i]].tag == tag[i]) {
-                providerComp = i;
-                break;
-            }
-        }
 
-        // See if any tags match for alternate predictor
-        for (int i = providerComp + 1; i < NUM_ITTAGE_TABLES; i++) {
-            if (ittagePred[i][index[i]].tag == tag[i]) {
-                altComp = i;
-                break;
-            }
-        }
+        // Compare every table's tag at once; the provider is the first
+        // match (T0 would be best) and the alternate the next
+        UINT32 stored[NUM_ITTAGE_TABLES];
+        for (int i = 0; i < NUM_ITTAGE_TABLES; i++)
+            stored[i] = ittagePred[i][index[i]].getTag();
+
+        UINT32 hits = tagMatchMask<NUM_ITTAGE_TABLES>(stored, tag);
+        providerComp = firstMatch(hits, NUM_ITTAGE_TABLES);
+        altComp = firstMatch(hits & (hits - 1), NUM_ITTAGE_TABLES);
 
         // Determine final prediction using confidence
         if (providerComp < NUM_ITTAGE_TABLES) { // Provider component found
@@ -170,13 +231,13 @@ public:
             if (altComp == NUM_ITTAGE_TABLES)
                 altPred = baseTarget; // Alt pred not found; use base predictor
             else
-                altPred = ittagePred[altComp][index[altComp]].target;
+                altPred = ittagePred[altComp][index[altComp]].getTarget();
 
             
-            INT32 confidence = ittagePred[providerComp][index[providerComp]].c;
+            INT32 confidence = ittagePred[providerComp][index[providerComp]].getC();
 
             if (confidence > 1 || altBetterCount <= ALT_BETTER_COUNT_MAX/2) {
-                providerPred = ittagePred[providerComp][index[providerComp]].target;
+                providerPred = ittagePred[providerComp][index[providerComp]].getTarget();
                 u.target_prediction(providerPred);
             }
             else
@@ -189,31 +250,36 @@ public:
 
 	void update (branch_update *u, bool taken, unsigned int target) {
         bool useless_entries_found = false;
+
+        if (indirectOnly && !(bi.br_flags & BR_INDIRECT)) {
+            advance(target);
+            return;
+        }
         
         // First, update the provider component's useful bit and target prediction
         if (providerComp < NUM_ITTAGE_TABLES) {
 
             if (u->target_prediction () != altPred) {
                 if (u->target_prediction () == target)
-                    ittagePred[providerComp][index[providerComp]].u = satIncrement(ittagePred[providerComp][index[providerComp]].u, static_cast<UINT32>(U_CTR_MAX));
+                    ittagePred[providerComp][index[providerComp]].setU(satIncrement(ittagePred[providerComp][index[providerComp]].getU(), static_cast<UINT32>(U_CTR_MAX)));
                 else
-                    ittagePred[providerComp][index[providerComp]].u = satDecrement(ittagePred[providerComp][index[providerComp]].u);
+                    ittagePred[providerComp][index[providerComp]].setU(satDecrement(ittagePred[providerComp][index[providerComp]].getU()));
             }
 
             if (u->target_prediction() != target) {
-                satDecrement(ittagePred[providerComp][index[providerComp]].c);
+                satDecrement(ittagePred[providerComp][index[providerComp]].getC());
 
-                if (ittagePred[providerComp][index[providerComp]].c == 0)
-                    ittagePred[providerComp][index[providerComp]].target = target;    
+                if (ittagePred[providerComp][index[providerComp]].getC() == 0)
+                    ittagePred[providerComp][index[providerComp]].setTarget(target);    
             } else
-                satIncrement(ittagePred[providerComp][index[providerComp]].c, C_CTR_MAX);
+                satIncrement(ittagePred[providerComp][index[providerComp]].getC(), C_CTR_MAX);
         } else {    // Update base predictor's target
             UINT32 bimodalIndex = bi.address % numBimodalEntries;
             bimodal[bimodalIndex] = target;
         }
 
         // Was the alternate prediction more useful?
-        if (providerComp < NUM_ITTAGE_TABLES && ittagePred[providerComp][index[providerComp]].u == 0) {					
+        if (providerComp < NUM_ITTAGE_TABLES && ittagePred[providerComp][index[providerComp]].getU() == 0) {					
             if (providerPred != altPred) {
                 if (altPred == target && altBetterCount < ALT_BETTER_COUNT_MAX)		
                     altBetterCount++;
@@ -227,7 +293,7 @@ public:
             // Look for an unused entry in smaller history tables
             if (providerComp > 0) {
                 for (int i = 0; i < providerComp; i++) {
-                    if (ittagePred[i][index[i]].u == 0) {
+                    if (ittagePred[i][index[i]].getU() == 0) {
                         useless_entries_found = true;
                         break;
                     }
@@ -236,26 +302,25 @@ public:
                 if (!useless_entries_found) {
                     // All entries are useful; decrease useful bits for all and do not allocate
                     for (int i = providerComp - 1; i >= 0; i--)
-                        ittagePred[i][index[i]].u = satDecrement(ittagePred[i][index[i]].u);
+                        ittagePred[i][index[i]].setU(satDecrement(ittagePred[i][index[i]].getU()));
                 } else {
-                    srand(time(NULL));
-                    int randNo = rand() % 100;
+                    int randNo = rng.next() % 100;
                     int count = 0;
-                    int bank_store[NUM_ITTAGE_TABLES - 1] = {-1, -1, -1};
+                    int bank_store[NUM_ITTAGE_TABLES];
                     int matchBank = 0;
 
-                    // Count the number of components with a useless entry
+                    // Collect the components with a useless entry, longest history (table 0) first
                     for (int i = 0; i < providerComp; i++) {
-                        if (ittagePred[i][index[i]].u == 0) {
+                        if (ittagePred[i][index[i]].getU() == 0) {
                             count++;
-                            bank_store[i] = i;
+                            bank_store[count - 1] = i;
                         }
                     } 
 
                     if (count == 1)
                         matchBank = bank_store[0];
                     else if (count > 1) {
-                        // More than one useless bank; choose one randomly with 2/3 preference for the component with longer history
+                        // More than one useless bank; 2/3 of the time take the one with the shortest history, nearest the provider, as in TAGE
                         if (randNo > 33 && randNo <= 99)
                             matchBank = bank_store[(count-1)];
                         else
@@ -264,11 +329,11 @@ public:
 
                     // Allocate an entry in the chosen bank
                     for (int i = matchBank; i >= 0; i--) {
-                        if (ittagePred[i][index[i]].u == 0) {
-                            ittagePred[i][index[i]].target = target;
-                            ittagePred[i][index[i]].tag = tag[i];
-                            ittagePred[i][index[i]].c = 1;
-                            ittagePred[i][index[i]].u = 0;
+                        if (ittagePred[i][index[i]].getU() == 0) {
+                            ittagePred[i][index[i]].setTarget(target);
+                            ittagePred[i][index[i]].setTag(tag[i]);
+                            ittagePred[i][index[i]].setC(1);
+                            ittagePred[i][index[i]].setU(0);
                             break;
                         }
                     }
@@ -276,40 +341,28 @@ public:
             }
         }
 
-        // Periodic useful bit reset
+        advance(target);
+    }
+
+private:
+    // Once per branch, whether or not the tables were touched
+    void advance (unsigned int target) {
+        // Periodic useful bit reset, applied lazily (see UsefulAging)
         clock++;
+        aging.scrub();
 
         if (clock == CLOCK_RESET_PERIOD) {
             clock = 0;
-            clock_flip = !clock_flip;
-
-            if (clock_flip) { // Reset MSB
-                for (int j = 0; j < NUM_ITTAGE_TABLES; j++) {
-                    for (UINT32 i = 0; i < numTagPredEntries; i++)
-                        ittagePred[j][i].u &= 1;
-                }
-            } else { // Reset LSB
-                for (int j = 0; j < NUM_ITTAGE_TABLES; j++) {
-                    for (UINT32 i = 0; i < numTagPredEntries; i++)
-                        ittagePred[j][i].u &= 2;
-                }
-            }
+            aging.reset();
         }
 
-        // Append branch target to GHR
-        GHR = (GHR << 1);
-        GHR.set(0, (target & 1));
+        // Append branch target to GHR and the LSB of the address to the PHR
+        if (!sharedHistory)
+            history->update(target & 1, bi.address);
+    }
+};
 
-        for (int i = 0; i < NUM_ITTAGE_TABLES; i++) {
-            indexComp[i].updateCompHist(GHR);
-            tagComp[0][i].updateCompHist(GHR);
-            tagComp[1][i].updateCompHist(GHR);
-        }
+typedef basic_ittage_predictor<PackedIttageEntry<ITTAGE_TAG_BITS> > ittage_predictor;
+typedef basic_ittage_predictor<IttageEntry> wide_ittage_predictor;	// the old unpacked layout
 
-        // Append the LSB of the address to the PHR
-        PHR = (PHR << 1);
-        if (bi.address & 1)
-            PHR += 1;
-        PHR &= ((1 << 16) - 1);
-    }
-};
\ No newline at end of file
+#endif // ITTAGE_H
@@ -1,38 +1,51 @@
 // Predictor 2: Loop Predictor
 
+#ifndef LOOP_PREDICTOR_H
+#define LOOP_PREDICTOR_H
+
 #include <cstdint>
 #include <fstream>
+#include "predictor.h"
+#include "tools.h"
 
-#define TAKEN		true
-#define NOT_TAKEN	false
-
-#define UINT8   uint8_t
 #define UINT16  uint16_t
-#define UINT32	uint32_t
-
-#define ENTRIES         256 // Number of entries in the predictor table
-#define WAY             4   // Associativity of the predictor table
-#define LOGIND          6   // Number of bits required to index into the table
-#define LOGWAY          2   // Number of bits required to determine the way at an index
-#define TAGSIZE         14  // Number of bits to represent tag in the table
-#define ITERSIZE        14  // Max size of the loop that the predictor can predict properly
+
+#define LOOP_LOG_SETS   6   // 2^6 sets
+#define LOOP_WAYS       4   // of 4 entries each
+#define LOOP_TAG_BITS   14  // Number of bits to represent tag in the table
+#define LOOP_ITER_BITS  14  // Max size of the loop that the predictor can predict properly
 #define AGE             31  // Initial age of the entry, good middle ground
 #define CONFIDENCE_MAX  3   // Recognize a branch as a loop after 3 successful executions
 #define NO_HIT          -1  // A symbol for not finding a hit
 
+// The loop predictor is meant to sit beside TAGE (see tage_sc_l.h) and
+// uses TAGE's prediction to decide when to age its entries.  On its own
+// there's nothing to compare against, so update() passes its own
+// prediction and its entries age only through allocation.  Only
+// conditional branches are looked up or trained.
+//
+// The table has 2^LogSets sets of Ways entries, with TagBits-bit tags
+// and IterBits-bit iteration counts.  The tags are kept apart from the
+// rest of the entries so that one vector compare finds the way that hit
+// (see wayMatchMask), and a big table costs no more per lookup than a
+// small one.
+
 struct LoopEntry {
-    UINT16 tag;          // Stores the 14-bit tag for the entry
-    UINT16 past_iter;    // Stores the 14-bit count for the number of iterations seen in past
-    UINT16 current_iter; // Stores the 14-bit count for the number of iterations seen currently
+    UINT16 past_iter;    // Stores the count for the number of iterations seen in past
+    UINT16 current_iter; // Stores the count for the number of iterations seen currently
     UINT8 age;           // 8-bit counter signifying age of entry
     UINT8 confidence;    // 2-bit counter signifying confidence in prediction
 };
 
-class loop_predictor {
+template <int LogSets = LOOP_LOG_SETS, int Ways = LOOP_WAYS, int TagBits = LOOP_TAG_BITS, int IterBits = LOOP_ITER_BITS>
+class basic_loop_predictor : public branch_predictor {
+    static_assert(TagBits <= 16 && IterBits <= 16, "tags and iteration counts are 16 bits");
+
 private:
-    LoopEntry table[ENTRIES];   // Predictor table
-    int ind;                // Index in loop
-    int hit;                // The way in the loop where we get a hit else -1
+    UINT16 *tags;           // Tag of each entry, a set at a time
+    LoopEntry *table;       // The rest of each entry
+    int ind;                // Index of the set's first entry
+    int hit;                // The entry where we get a hit else -1
     int tag;                // The tag calculated
     UINT8 seed;
 
@@ -43,44 +56,71 @@ public:
     bool is_valid;  // Validity of prediction
     bool loop_pred; // The prediction returned for current PC
 
-    void reset_loop_entry (LoopEntry &entry) {
-        entry.tag = 0;
-        entry.past_iter = 0;
-        entry.current_iter = 0;
-        entry.age = 0;
-        entry.confidence = 0;
+    static constexpr int Entries = (1 << LogSets) * Ways;
+
+    void reset_loop_entry (int i) {
+        tags[i] = 0;
+        table[i].past_iter = 0;
+        table[i].current_iter = 0;
+        table[i].age = 0;
+        table[i].confidence = 0;
     }
 
-    loop_predictor (void) {
+    basic_loop_predictor (void) {
         seed = 0;
-        for (int i = 0; i < ENTRIES; i++) {
-            reset_loop_entry(table[i]);
+        tags = new UINT16[Entries];
+        table = new LoopEntry[Entries];
+        for (int i = 0; i < Entries; i++) {
+            reset_loop_entry(i);
         }
     }
 
+    ~basic_loop_predictor (void) {
+        delete[] tags;
+        delete[] table;
+    }
+
+    bool checkpoint (predictor_state & s) {
+        s.array(tags, Entries);
+        s.array(table, Entries);
+        s.value(seed);
+        return s.complete();
+    }
+
+    // Bits of state: tag, both iteration counts, age and confidence per entry
+    static constexpr long StorageBits = (long) Entries * (TagBits + 2 * IterBits + 8 + 2);
+
     branch_update *predict (branch_info & b) {
+        bi = b;
         hit = NO_HIT;
-        ind = (b.address & ((1 << LOGIND) - 1)) << LOGWAY;  // Calculate index
-        tag = (b.address >> LOGIND) & ((1 << TAGSIZE) - 1); // Calculate tag
+        if (!(b.br_flags & BR_CONDITIONAL)) {
+            is_valid = false;
+            loop_pred = TAKEN;
+            u.direction_prediction(TAKEN);
+            u.target_prediction(0);
+            return &u;
+        }
+
+        ind = (b.address & ((1 << LogSets) - 1)) * Ways;     // Calculate index
+        tag = (b.address >> LogSets) & ((1 << TagBits) - 1); // Calculate tag
         u.target_prediction (0);
 
-        // Try to find a matching entry
-        for (int i = ind; i < ind + WAY; i++) {
+        // Try to find a matching entry; the first way that matches
+        UINT32 ways = wayMatchMask<Ways>(tags + ind, tag);
+        if (ways) {
+            int i = ind + firstMatch(ways, Ways);
+            hit = i;
+            is_valid = (table[i].confidence == CONFIDENCE_MAX);  // Only want high confidence
             
-            if (table[i].tag == tag) {
-                hit = i;
-                is_valid = (table[i].confidence == CONFIDENCE_MAX);  // Only want high confidence
-                
-                // Loop is on last iteration TODO MIGHT NEED TO CHANGE THIS
-                if (table[i].current_iter + 1 == table[i].past_iter) {
-                    loop_pred = NOT_TAKEN;
-                    u.direction_prediction(NOT_TAKEN);
-                } else {
-                    loop_pred = TAKEN;
-                    u.direction_prediction(TAKEN);
-                }
-                return &u;
+            // Loop is on last iteration TODO MIGHT NEED TO CHANGE THIS
+            if (table[i].current_iter + 1 == table[i].past_iter) {
+                loop_pred = NOT_TAKEN;
+                u.direction_prediction(NOT_TAKEN);
+            } else {
+                loop_pred = TAKEN;
+                u.direction_prediction(TAKEN);
             }
+            return &u;
         }
 
         // No matching entry found in table
@@ -90,14 +130,20 @@ public:
         return &u;
     }
 
+    void update (branch_update *u, bool taken, unsigned int target) {
+        update(u, taken, target, loop_pred);
+    }
+
     void update (branch_update *u, bool taken, unsigned int target, bool tage_pred) {
+        if (!(bi.br_flags & BR_CONDITIONAL))
+            return;
         if (hit > NO_HIT) {
             LoopEntry &entry = table[hit];
     
             if (is_valid) {
                 // If the predicton was wrong, free the entry
                 if (taken != loop_pred) {
-                    reset_loop_entry(entry);
+                    reset_loop_entry(hit);
                     return;
                 }
     
@@ -107,7 +153,7 @@ public:
             }
             
             entry.current_iter++;
-            entry.current_iter &= ((1 << ITERSIZE) - 1);
+            entry.current_iter &= ((1 << IterBits) - 1);
             
             // If the iteration is greater than what was seen last time, free the entry
             if (entry.current_iter > entry.past_iter)
@@ -115,7 +161,7 @@ public:
                 entry.confidence = 0;
     
                 if (entry.past_iter != 0)
-                    reset_loop_entry(entry);
+                    reset_loop_entry(hit);
             }
     
             if (!taken) {
@@ -126,26 +172,26 @@ public:
                     
                     // We do not care for loops with < 3 iterations
                     if (entry.past_iter > 0 && entry.past_iter < 3)
-                        reset_loop_entry(entry);
+                        reset_loop_entry(hit);
                 } else {
                     // Set the newly allocated entry
                     if (entry.past_iter == 0) {
                         entry.confidence = 0;
                         entry.past_iter = entry.current_iter;
                     } else// else free the entry
-                        reset_loop_entry(entry);
+                        reset_loop_entry(hit);
                 }
                 entry.current_iter = 0;
             }
         } else if (taken) {
             // If the branch is taken but there is no entry, we must allocate one entry in the table
-            seed = (seed + 1) & 3;
+            seed = (seed + 1) % Ways;
     
-            for (int i = 0; i < WAY; i++) {
-                int j = ind + ((seed + i) & 3);
+            for (int i = 0; i < Ways; i++) {
+                int j = ind + (seed + i) % Ways;
     
                 if (table[j].age == 0) {
-                    table[j].tag = tag;
+                    tags[j] = tag;
                     table[j].past_iter = 0;
                     table[j].current_iter = 1;
                     table[j].age = AGE;
@@ -157,4 +203,9 @@ public:
             }
         }
     }
-};
\ No newline at end of file
+};
+
+typedef basic_loop_predictor<> loop_predictor;
+typedef basic_loop_predictor<9, 8> loop4k_predictor;	// 512 sets of 8
+
+#endif // LOOP_PREDICTOR_H
@@ -1,8 +1,13 @@
+#ifndef MY_PREDICTOR_H
+#define MY_PREDICTOR_H
+
 #include <iostream>
 #include <fstream>
 #include "tage.h"
-#include "loop_predictor.h"
+#include "tage_sc_l.h"
 #include "ittage.h"
+#include "btb.h"
+#include "ras.h"
 
 // std::ofstream out("a.txt");
 
@@ -11,50 +16,87 @@ class my_update : public branch_update {
         unsigned int index;
 };
     
-class my_predictor : public branch_predictor {
+// Direction is TAGE, or anything else that predicts directions from a
+// shared HistoryProvider of the same type as ITTAGE's
+template <class Direction>
+class basic_my_predictor : public branch_predictor {
 public:
-    tage_predictor tage;
-    // loop_predictor loop;
+    // One global/path history for both components, updated with the
+    // outcome of each conditional branch; declared first so it is
+    // constructed before they subscribe to it
+    typename Direction::History history;
+    Direction tage;
     ittage_predictor ittage;
+
+    // Targets of returns come from the RAS, of other indirect branches
+    // from ITTAGE, and of direct branches from the BTB
+    ras_predictor ras;
+    btb_predictor btb;
     
     branch_update* tage_pred;
-    // branch_update* loop_pred;
     branch_update* ittage_pred;
-    
-    int loop_correct;
+    branch_update* ras_pred;
+    branch_update* btb_pred;
+    branch_update u;
+    branch_info bi;
 
-    my_predictor (void): loop_correct(0) {}
+    // ITTAGE is only asked for the targets of indirect branches, so by
+    // default it leaves its tables alone on the others
+    basic_my_predictor (bool ittage_indirect_only = true):
+        tage(&history), ittage(&history, ittage_indirect_only) {}
+
+    // give the components different random streams
+    void seed (unsigned int s) {
+        tage.seed(s);
+        ittage.seed(s ^ 0x5bd1e995);
+        btb.seed(s ^ 0x27d4eb2d);
+    }
 
-    // void update_ctr (bool taken) {
-    //     if (taken == loop_pred->direction_prediction()) {
-    //         if (loop_correct < 127) 
-    //             loop_correct++;
-    //     }
-    //     else if (loop_correct > -126) 
-    //         loop_correct--;
-    // }
+    // the components' own checks would fail part way through the state,
+    // so only the whole is checked
+    bool checkpoint (predictor_state & s) {
+        tage.checkpoint(s);
+        ittage.checkpoint(s);
+        ras.checkpoint(s);
+        btb.checkpoint(s);
+        history.checkpoint(s);
+        return s.complete();
+    }
 
     branch_update *predict (branch_info & b) {
+        bi = b;
         tage_pred = tage.predict(b);
-        // loop_pred = loop.predict(b);
         ittage_pred = ittage.predict(b);
 
-        // // if (loop.is_valid && loop_correct >= 0) {
-        // //     return loop_pred;
-        // // }
+        // The RAS sees every call and return so it can push and pop
+        if (b.br_flags & (BR_CALL | BR_RETURN))
+            ras_pred = ras.predict(b);
+        if (!(b.br_flags & (BR_RETURN | BR_INDIRECT)))
+            btb_pred = btb.predict(b);
 
-        if (b.br_flags & BR_INDIRECT)
-            return ittage_pred;
+        u.direction_prediction(tage_pred->direction_prediction());
+        if (b.br_flags & BR_RETURN)
+            u.target_prediction(ras_pred->target_prediction());
+        else if (b.br_flags & BR_INDIRECT)
+            u.target_prediction(ittage_pred->target_prediction());
         else
-            return tage_pred;
+            u.target_prediction(btb_pred->target_prediction());
+        return &u;
     }
 
-    void update (branch_update *u, bool taken, unsigned int target) {
-        tage.update(u, taken, target);
-        // loop.update(u, taken, target, tage_pred->direction_prediction());
-        ittage.update(u, taken, target);
-
-        // if (loop.is_valid && tage_pred->direction_prediction() != loop_pred->direction_prediction()) 
-        //     update_ctr(taken);
+    void update (branch_update *, bool taken, unsigned int target) {
+        tage.update(tage_pred, taken, target);
+        ittage.update(ittage_pred, taken, target);
+        if (bi.br_flags & (BR_CALL | BR_RETURN))
+            ras.update(ras_pred, taken, target);
+        if (!(bi.br_flags & (BR_RETURN | BR_INDIRECT)))
+            btb.update(btb_pred, taken, target);
+        if (bi.br_flags & BR_CONDITIONAL)
+            history.update(taken, bi.address);
     }
-};
\ No newline at end of file
+};
+
+typedef basic_my_predictor<tage_predictor> my_predictor;
+typedef basic_my_predictor<tage_sc_l_predictor> my_sc_l_predictor;
+
+#endif // MY_PREDICTOR_H
@@ -0,0 +1,320 @@
+// Predictor 4: Hashed Perceptron
+
+#ifndef PERCEPTRON_H
+#define PERCEPTRON_H
+
+#include <cstdint>
+#include <algorithm>
+#include "tools.h"
+
+// Each feature table is indexed by a hash of the branch address and one
+// feature of the branch's context, and holds 8bit signed weights.  The
+// prediction is taken if the sum of the selected weights is >= 0.  When
+// the prediction is wrong, or the sum is no bigger than theta, each
+// selected weight moves one step toward the outcome.  Theta adapts as in
+// O-GEHL so that about as many updates come from low confidence as from
+// mispredictions.
+
+#define PERCEPTRON_MAX_FEATURES	32
+#define PERCEPTRON_TC_MAX		63	// 7bit threshold training counter
+#define PERCEPTRON_TC_MIN		(-64)
+
+// What a feature table hashes with the branch address.  start and end
+// pick bits [start, end) of the global history, of the 16bit path
+// history, or of the branch address; a bias table uses the address alone.
+// An input table hashes the address with a few bits a composite predictor
+// passes to output(), such as another component's prediction.
+enum perceptron_feature_kind {
+	PF_BIAS,
+	PF_GHIST,
+	PF_PATH,
+	PF_PC,
+	PF_INPUT
+};
+
+#define PERCEPTRON_INPUT_BITS	4	// bits of input an input table sees
+
+struct perceptron_feature {
+	perceptron_feature_kind kind;
+	int start, end;
+};
+
+// The default features: a bias table, global history segments that
+// overlap and grow longer with age out to 256 branches, two path
+// histories and the high bits of the address
+struct perceptron_default_features {
+	static constexpr int numFeatures = 16;
+	static constexpr perceptron_feature features[numFeatures] = {
+		{ PF_BIAS, 0, 0 },
+		{ PF_GHIST, 0, 4 }, { PF_GHIST, 0, 8 }, { PF_GHIST, 4, 12 }, { PF_GHIST, 8, 16 },
+		{ PF_GHIST, 12, 24 }, { PF_GHIST, 16, 32 }, { PF_GHIST, 24, 48 }, { PF_GHIST, 32, 64 },
+		{ PF_GHIST, 48, 96 }, { PF_GHIST, 64, 128 }, { PF_GHIST, 96, 192 }, { PF_GHIST, 128, 256 },
+		{ PF_PATH, 0, 8 }, { PF_PATH, 0, 16 },
+		{ PF_PC, 10, 20 }
+	};
+};
+
+// Longest global history the features use
+template <class Features>
+constexpr int perceptron_max_history (void) {
+	int h = 0;
+	for (int i = 0; i < Features::numFeatures; i++)
+		if (Features::features[i].kind == PF_GHIST)
+			h = std::max (h, Features::features[i].end);
+	return h;
+}
+
+// Storage budget calculator: bits of state for 2^logSize weights per
+// table, or twice that in the last bigTables tables; the weights, the
+// global and path history (the folded copies of the global history can be
+// recomputed from it), theta and its training counter
+template <class Features>
+constexpr long perceptron_storage_bits (int logSize, int bigTables = 0) {
+	return ((long) Features::numFeatures + bigTables) * (1L << logSize) * 8
+		+ perceptron_max_history<Features> () + 16 + 8 + 7;
+}
+
+// The largest table size that fits in budgetBits
+template <class Features>
+constexpr int perceptron_log_size (long budgetBits) {
+	int logSize = 1;
+	while (perceptron_storage_bits<Features> (logSize + 1) <= budgetBits)
+		logSize++;
+	return logSize;
+}
+
+// How many tables of that size can be doubled in what's left
+template <class Features>
+constexpr int perceptron_big_tables (long budgetBits) {
+	int logSize = perceptron_log_size<Features> (budgetBits), n = 0;
+	while (n < Features::numFeatures && perceptron_storage_bits<Features> (logSize, n + 1) <= budgetBits)
+		n++;
+	return n;
+}
+
+template <class Features, int LogSize, int BigTables = 0>
+struct perceptron_config : Features {
+	static constexpr int logSize = LogSize;
+	static constexpr int bigTables = BigTables;
+	static_assert(Features::numFeatures >= 1 && Features::numFeatures <= PERCEPTRON_MAX_FEATURES
+		&& BigTables >= 0 && BigTables <= Features::numFeatures, "bad perceptron configuration");
+};
+
+// A configuration with the most weights that fit in budgetBytes
+template <class Features, long BudgetBytes>
+struct perceptron_budget_config : perceptron_config<Features, perceptron_log_size<Features> (BudgetBytes * 8),
+	perceptron_big_tables<Features> (BudgetBytes * 8)> {};
+
+// Sum of the first N of 8bit weights w, whose length is a multiple of 32
+// and whose unused tail is 0.  The vector paths sum unsigned bytes with
+// psadbw after biasing each weight by 128, and take the bias back off.
+template <int N>
+inline int perceptronSum (const int8_t *w) {
+	int sum = 0;
+	int i = 0;
+#ifdef __AVX2__
+	for (; i < N; i += 32) {
+		__m256i v = _mm256_xor_si256(_mm256_load_si256((const __m256i *) (w + i)), _mm256_set1_epi8((char) 0x80));
+		__m256i s = _mm256_sad_epu8(v, _mm256_setzero_si256());
+		sum += _mm256_extract_epi64(s, 0) + _mm256_extract_epi64(s, 1) + _mm256_extract_epi64(s, 2)
+			+ _mm256_extract_epi64(s, 3) - 32 * 128;
+	}
+#elif defined(__SSE2__)
+	for (; i < N; i += 16) {
+		__m128i v = _mm_xor_si128(_mm_load_si128((const __m128i *) (w + i)), _mm_set1_epi8((char) 0x80));
+		__m128i s = _mm_sad_epu8(v, _mm_setzero_si128());
+		sum += _mm_cvtsi128_si32(s) + _mm_extract_epi16(s, 4) - 16 * 128;
+	}
+#endif
+	for (; i < N; i++)
+		sum += w[i];
+	return sum;
+}
+
+// Move the first N weights one step toward the outcome, saturating at
+// -128 and 127; d holds +1 (taken) or -1 in the first N bytes and 0 after
+template <int N>
+inline void perceptronTrain (int8_t *w, const int8_t *d) {
+	int i = 0;
+#ifdef __AVX2__
+	for (; i < N; i += 32)
+		_mm256_store_si256((__m256i *) (w + i), _mm256_adds_epi8(_mm256_load_si256((const __m256i *) (w + i)),
+			_mm256_load_si256((const __m256i *) (d + i))));
+#elif defined(__SSE2__)
+	for (; i < N; i += 16)
+		_mm_store_si128((__m128i *) (w + i), _mm_adds_epi8(_mm_load_si128((const __m128i *) (w + i)),
+			_mm_load_si128((const __m128i *) (d + i))));
+#endif
+	for (; i < N; i++)
+		w[i] = (int8_t) std::max (-128, std::min (127, w[i] + d[i]));
+}
+
+template <class Config>
+class hashed_perceptron : public branch_predictor {
+public:
+	static constexpr int NumFeatures = Config::numFeatures;
+	static constexpr int LogSize = Config::logSize;
+	static constexpr int BigTables = Config::bigTables;
+	static constexpr int Lanes = (NumFeatures + 31) & ~31;	// weights gathered for the vector sum
+	static constexpr long StorageBits = perceptron_storage_bits<Config> (LogSize, BigTables);
+	typedef HistoryProvider<std::max (HIST_BUFFER_LOG, floorLog2 (perceptron_max_history<Config> ()) + 1)> History;
+
+	// log2 of the number of weights in table i
+	static constexpr int tableLog (int i) { return LogSize + (i >= NumFeatures - BigTables); }
+
+private:
+	// Histories; our own unless a composite predictor shares its own
+	History ownHistory;
+	History *history;
+	bool sharedHistory;
+
+	// Folded global history at the ends of each segment; NULL for 0
+	const UINT32 *foldEnd[NumFeatures];
+	const UINT32 *foldStart[NumFeatures];
+
+	int8_t *weights[NumFeatures];
+	UINT32 index[NumFeatures];
+	alignas(32) int8_t w[Lanes];	// the selected weights
+	int sum;
+
+	int theta;		// train when |sum| <= theta
+	int tc;			// theta training counter
+
+	static UINT32 fold (UINT32 x, int bits) {
+		return (x ^ (x >> bits) ^ (x >> (2 * bits))) & ((1 << bits) - 1);
+	}
+
+	const UINT32 *subscribe (int length, int bits) {
+		return length ? history->subscribe(length, bits) : NULL;
+	}
+
+public:
+	branch_update u;
+	branch_info bi;
+
+	// Subscribe to shared, which the caller updates after each conditional branch, if given
+	hashed_perceptron (History *shared = 0) : history(shared ? shared : &ownHistory), sharedHistory(shared != 0) {
+		for (int i = 0; i < NumFeatures; i++) {
+			weights[i] = new int8_t[1 << tableLog(i)];
+			memset(weights[i], 0, 1 << tableLog(i));
+			index[i] = 0;
+			foldStart[i] = foldEnd[i] = NULL;
+			if (Config::features[i].kind == PF_GHIST) {
+				foldStart[i] = subscribe(Config::features[i].start, tableLog(i));
+				foldEnd[i] = subscribe(Config::features[i].end, tableLog(i));
+			}
+		}
+		memset(w, 0, sizeof(w));
+		sum = 0;
+		theta = (int) (1.93 * NumFeatures + 14);
+		tc = 0;
+	}
+
+	~hashed_perceptron (void) {
+		for (int i = 0; i < NumFeatures; i++)
+			delete[] weights[i];
+	}
+
+	bool checkpoint (predictor_state & s) {
+		for (int i = 0; i < NumFeatures; i++)
+			s.array(weights[i], 1 << tableLog(i));
+		s.value(theta);
+		s.value(tc);
+		if (!sharedHistory)
+			history->checkpoint(s);
+		return s.complete();
+	}
+
+	// The weight sum for b; >= 0 means taken.  A statistical corrector
+	// can use this directly, with its input, and then call train().
+	int output (const branch_info & b, UINT32 input = 0) {
+		UINT32 pc = b.address;
+		UINT32 PHR = history->PHR;
+
+		for (int i = 0; i < NumFeatures; i++) {
+			const perceptron_feature & f = Config::features[i];
+			UINT32 h;
+			switch (f.kind) {
+			case PF_GHIST:
+				h = pc ^ *foldEnd[i] ^ (foldStart[i] ? *foldStart[i] : 0);
+				break;
+			case PF_PATH:
+				h = pc ^ (((PHR >> f.start) & ((1 << (f.end - f.start)) - 1)) << 1);
+				break;
+			case PF_PC:
+				h = (pc >> f.start) & ((1 << (f.end - f.start)) - 1);
+				break;
+			case PF_INPUT:
+				h = (pc << PERCEPTRON_INPUT_BITS) ^ (input & ((1 << PERCEPTRON_INPUT_BITS) - 1));
+				break;
+			default:
+				h = pc;
+			}
+			index[i] = fold(h, tableLog(i));
+			w[i] = weights[i][index[i]];
+		}
+		sum = perceptronSum<NumFeatures>(w);
+		return sum;
+	}
+
+	// How far from 0 a sum must be before training leaves it alone
+	int threshold (void) const { return theta; }
+
+	// Train the weights output() last selected toward taken
+	void train (bool taken) {
+		bool mispredicted = (sum >= 0) != taken;
+		int magnitude = sum < 0 ? -sum : sum;
+
+		if (mispredicted || magnitude <= theta) {
+			alignas(32) int8_t d[Lanes];
+			memset(d, 0, sizeof(d));
+			memset(d, taken ? 1 : -1, NumFeatures);
+			perceptronTrain<NumFeatures>(w, d);
+			for (int i = 0; i < NumFeatures; i++)
+				weights[i][index[i]] = w[i];
+		}
+
+		// Adapt theta (as in O-GEHL)
+		if (mispredicted) {
+			if (++tc > PERCEPTRON_TC_MAX) {
+				theta++;
+				tc = 0;
+			}
+		} else if (magnitude <= theta) {
+			if (--tc < PERCEPTRON_TC_MIN) {
+				theta = std::max (1, theta - 1);
+				tc = 0;
+			}
+		}
+	}
+
+	branch_update *predict (branch_info & b) {
+		bi = b;
+		if (b.br_flags & BR_CONDITIONAL)
+			u.direction_prediction(output(b) >= 0);
+		else
+			u.direction_prediction(true);
+		u.target_prediction(0);
+		return &u;
+	}
+
+	void update (branch_update *, bool taken, unsigned int) {
+		if (bi.br_flags & BR_CONDITIONAL) {
+			train(taken);
+			if (!sharedHistory)
+				history->update(taken, bi.address);
+		}
+	}
+};
+
+// The most weights that fit in 32KB and 64KB budgets.  16 x 2K weights
+// alone would fill 32KB and leave no room for the history, so the 32KB
+// one has 2K weights in 15 tables and 1K in the bias table; the 64KB one
+// likewise has 4K and 2K.
+typedef hashed_perceptron<perceptron_budget_config<perceptron_default_features, 32 * 1024> > perceptron_predictor;
+typedef hashed_perceptron<perceptron_budget_config<perceptron_default_features, 64 * 1024> > perceptron64_predictor;
+
+static_assert(perceptron_predictor::StorageBits <= 32 * 1024 * 8 && perceptron64_predictor::StorageBits <= 64 * 1024 * 8,
+	"perceptron over budget");
+
+#endif // PERCEPTRON_H
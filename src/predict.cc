@@ -1,121 +1,569 @@
 // predict.cc
-// This file contains the main function.  The program accepts a single 
-// parameter: the name of a trace file.  It drives the branch predictor
-// simulation by reading the trace file and feeding the traces one at a time
-// to the branch predictor.
+// This file contains the main function.  The program accepts the names of
+// one or more trace files.  It drives the branch predictor simulation by
+// reading each trace file and feeding the traces one at a time to the
+// branch predictor.  With one trace file it prints the MPKI; with more,
+// it simulates them at the same time on a pool of threads, each with its
+// own predictor, and prints each trace's MPKI and run time, the average
+// MPKI, and the wall-clock time, replacing the old run script's loop.
+//
+// -j <n> simulates up to n traces at a time (default: one per CPU).  the
+//    largest trace files are started first so the last one to finish
+//    isn't a big one started late.
+// -c <dir> keeps a decode-once cache of the trace in dir (see trace_cache.h)
+// -t <n> decompresses a bzip2 trace with n threads (see bzip2_parallel.h)
+// -T decodes the trace on a separate thread (see trace_pipeline.h) and
+//    reports on stderr how long each side waited for the other
+// -s <first> -n <count> simulates only branches first through
+//    first+count-1, seeking with the trace's index if it has one (see
+//    trace_index.h).  MPKI is still per 100 million instructions, so the
+//    results of disjoint slices add up to the result for the whole trace.
+// -w <warm> simulates the warm branches before first without counting
+//    them, so the predictor isn't cold at the start of the slice
+// -P <name>,<name>,... simulates each of the named predictors (see
+//    predictors.h) over the same decode of each trace and reports the
+//    MPKI of each; -P list lists them.  the default is my_predictor.
+// -p runs each of the predictors on its own thread, all of them working
+//    through the same block of branches at once
+// -V calls the predictors through the virtual functions in
+//    branch_predictor instead of calling each predictor type directly
+//    (see simulate.h)
+// -v reports on stderr the time each predictor took per branch
+// -S <seed> seeds the random choices the predictors make (default 1); the
+//    same seed always gives the same results
+// -b also reports each predictor's target MPKI for each class of branch
+//    (see simulate.h), averaged over the traces
+// -C <dir> saves the state of the predictors after the last branch
+//    simulated from each trace in a checkpoint in dir (see checkpoint.h)
+// -L <dir> starts the predictors from the trace's checkpoint in dir
+//    instead of cold.  the checkpoint has to have been taken at the
+//    start of the slice, e.g. -n 20000000 -C dir and then -s 20000000
+//    -L dir, which seeks there with the trace's index if it has one.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> // in case you want to use e.g. memset
 #include <assert.h>
 #include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
 
 #include "branch.h"
 #include "trace.h"
+#include "trace_pipeline.h"
 #include "predictor.h"
-#include "my_predictor.h"
+#include "simulate.h"
+#include "predictors.h"
+#include "checkpoint.h"
+
+// number of traces to decode at a time
+
+#define BLOCK_SIZE	4096
 
 // std::ofstream logfile("output.txt", std::ios::app);
 
-int main (int argc, char *argv[]) {	
+static double now_seconds (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// options that apply to every trace
+
+static bool pipelined = false, thread_per_predictor = false, virtual_calls = false, timing = false, by_class = false;
+static unsigned long long first = 0, count = 0, warm = 0;
+static unsigned int random_seed = 1;
+static const char *save_dir = NULL, *load_dir = NULL;
+static std::vector<const predictor_entry *> predictors;
+
+// what happened when one trace was simulated
+
+struct sim_result {
+	std::vector<predictor_stats> stats;	// one per predictor
+	double seconds;
+
+	// how long the decode thread and the simulator waited for each
+	// other with -T
+
+	double producer_stall_seconds, consumer_wait_seconds;
+	long long int producer_stalls, consumer_waits;
+};
+
+// run a block through one predictor and add the time it took to the
+// predictor's statistics
 
-	// make sure there is one parameter
-	if (argc != 2) {
-		fprintf (stderr, "Usage: %s <filename>.gz\n", argv[0]);
+static void timed_block (block_simulator sim, branch_predictor *p, predictor_stats *s, trace *block, size_t n, unsigned long long position) {
+	double start = now_seconds ();
+	sim (p, s, block, n, position, first);
+	s->seconds += now_seconds () - start;
+	s->simulated += n;
+}
+
+// with -p, one thread per predictor after the first (which runs on the
+// simulating thread).  each block is handed to all of them at once by
+// bumping generation; the simulating thread waits until pending drops to
+// zero before it reuses the block.
+
+struct predictor_threads {
+	std::mutex lock;
+	std::condition_variable go, done;
+	unsigned long long generation;
+	int pending;
+	bool stopping;
+
+	trace *block;
+	size_t n;
+	unsigned long long position;
+
+	std::vector<std::thread> threads;
+
+	predictor_threads (void) : generation(0), pending(0), stopping(false) {}
+
+	void start (std::vector<block_simulator> & sim, std::vector<branch_predictor *> & p, std::vector<predictor_stats> & s) {
+		for (size_t i=1; i<p.size (); i++)
+			threads.push_back (std::thread ([this, &sim, &p, &s, i] (void) { run (sim[i], p[i], &s[i]); }));
+	}
+
+	void run (block_simulator sim, branch_predictor *p, predictor_stats *s) {
+		unsigned long long seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> l (lock);
+				go.wait (l, [&] { return stopping || generation != seen; });
+				if (stopping) return;
+				seen = generation;
+			}
+			timed_block (sim, p, s, block, n, position);
+			std::lock_guard<std::mutex> l (lock);
+			if (--pending == 0) done.notify_one ();
+		}
+	}
+
+	// start the other threads on a block, do the first predictor's
+	// share, and wait for the rest
+
+	void simulate (block_simulator sim0, branch_predictor *p0, predictor_stats *s0, trace *b, size_t nb, unsigned long long pos) {
+		{
+			std::lock_guard<std::mutex> l (lock);
+			block = b;
+			n = nb;
+			position = pos;
+			pending = threads.size ();
+			generation++;
+		}
+		go.notify_all ();
+		timed_block (sim0, p0, s0, b, nb, pos);
+		std::unique_lock<std::mutex> l (lock);
+		done.wait (l, [&] { return pending == 0; });
+	}
+
+	void stop (void) {
+		{
+			std::lock_guard<std::mutex> l (lock);
+			stopping = true;
+		}
+		go.notify_all ();
+		for (auto & t : threads) t.join ();
+		threads.clear ();
+	}
+};
+
+// with -L, restore each predictor from the trace's checkpoint, which has
+// to have been taken at the start of the slice and to hold a state for a
+// predictor of the same name.  a name given more than once takes the
+// states saved under it in order.
+
+static void load_checkpoint (const char *fname, std::vector<branch_predictor *> & p) {
+	char cname[1000];
+	unsigned long long branch;
+	std::vector<std::string> names;
+	std::vector<predictor_state> states;
+
+	predictor_checkpoint_name (cname, sizeof (cname), load_dir, fname);
+	if (!load_predictor_checkpoint (cname, fname, &branch, names, states)) {
+		fprintf (stderr, "%s: no usable predictor checkpoint for %s\n", cname, fname);
 		exit (1);
 	}
+	if (branch != first) {
+		fprintf (stderr, "%s: taken after branch %llu, not %llu; use -s %llu\n", cname, branch, first, branch);
+		exit (1);
+	}
+	std::vector<bool> used (names.size (), false);
+	for (size_t i=0; i<p.size (); i++) {
+		size_t k = 0;
+		while (k < names.size () && (used[k] || names[k] != predictors[i]->name)) k++;
+		if (k == names.size ()) {
+			fprintf (stderr, "%s: no state for %s\n", cname, predictors[i]->name);
+			exit (1);
+		}
+		used[k] = true;
+		if (!p[i]->checkpoint (states[k])) {
+			fprintf (stderr, "%s: the state for %s doesn't fit it\n", cname, predictors[i]->name);
+			exit (1);
+		}
+	}
+}
 
-	// open the trace file for reading
+// with -C, save the predictors' states after position branches
 
-	init_trace (argv[1]);
+static void save_checkpoint (const char *fname, std::vector<branch_predictor *> & p, unsigned long long position) {
+	char cname[1000];
+	std::vector<std::string> names;
+	std::vector<predictor_state> states (p.size ());
 
-	// initialize competitor's branch prediction code
+	for (size_t i=0; i<p.size (); i++) {
+		names.push_back (predictors[i]->name);
+		p[i]->checkpoint (states[i]);
+	}
+	predictor_checkpoint_name (cname, sizeof (cname), save_dir, fname);
+	if (!save_predictor_checkpoint (cname, fname, position, names, states)) exit (1);
+}
 
-	branch_predictor *p = new my_predictor ();
+// simulate one trace with a fresh set of predictors
 
-	// some statistics to keep, currently just for conditional branches
+static void simulate (const char *fname, sim_result *r) {
+	double start_time = now_seconds ();
 
-	long long int 
-		tmiss = 0, 	// number of target mispredictions
-		dmiss = 0, 	// number of direction mispredictions
-		total_misses = 0, // number of combined misprediction
-		total_branches = 0;
+	// start decoding warm branches before the slice, and stop after
+	// the slice (or at the end of the trace if there's no count)
 
-	long long int total_conditional = 0;
-	long long int total_indirect = 0;
+	unsigned long long w = warm > first ? first : warm;
+	unsigned long long
+		start = first - w,
+		stop = count ? first + count : ~0ULL,
+		position = start;
 
-	// keep looping until end of file
+	// open the trace file for reading, maybe on a decode thread
 
-	for (;;) {
+	trace_pipeline *pipeline = NULL;
+	trace_reader *reader = NULL;
+
+	if (pipelined) {
+		pipeline = new trace_pipeline;
+		pipeline->open (fname, start);
+	} else {
+		reader = new trace_reader;
+		reader->open_at (fname, start);
+	}
+
+	// initialize competitors' branch prediction code
+
+	size_t np = predictors.size ();
+	std::vector<branch_predictor *> p (np);
+	std::vector<block_simulator> sim (np);
+	for (size_t i=0; i<np; i++) {
+		p[i] = predictors[i]->make ();
+		p[i]->seed (random_seed);
+		sim[i] = virtual_calls ? simulate_block<branch_predictor> : predictors[i]->simulate;
+	}
+	if (load_dir) load_checkpoint (fname, p);
+
+	// some statistics to keep for each predictor
 
-		// get a trace
+	r->stats.assign (np, predictor_stats ());
 
-		trace *t = read_trace ();
+	predictor_threads workers;
+	if (thread_per_predictor) workers.start (sim, p, r->stats);
 
-		// NULL means end of file
+	// keep looping until end of file, decoding the traces a block at a
+	// time and giving each block to every predictor
 
-		if (!t) break;
+	trace *buf = new trace[BLOCK_SIZE];
 
-		// send this trace to the competitor's code for prediction
+	while (position < stop) {
+		trace *block = buf;
+		size_t n;
 
-		branch_update *u = p->predict (t->bi);
+		if (pipeline)
+			block = pipeline->acquire (&n);
+		else
+			n = reader->next (buf, BLOCK_SIZE);
+		if (!n) break;
+		if (n > stop - position) n = stop - position;
 
-		// collect statistics for a conditional branch trace
+		if (thread_per_predictor)
+			workers.simulate (sim[0], p[0], &r->stats[0], block, n, position);
+		else
+			for (size_t i=0; i<np; i++)
+				timed_block (sim[i], p[i], &r->stats[i], block, n, position);
+		position += n;
 
-		total_branches++;
+		// hand the block back to the decode thread
 
-		// compare to gshare mispredictions for dmiss and tmiss
+		if (pipeline) pipeline->release ();
+	}
+	delete [] buf;
+	workers.stop ();
+	if (save_dir) save_checkpoint (fname, p, position);
+
+	// logfile.close();
+
+	// done reading traces
+
+	r->producer_stalls = r->consumer_waits = 0;
+	r->producer_stall_seconds = r->consumer_wait_seconds = 0;
+	if (pipeline) {
+		pipeline->close ();
+		r->producer_stalls = pipeline->producer_stalls;
+		r->producer_stall_seconds = pipeline->producer_stall_seconds;
+		r->consumer_waits = pipeline->consumer_waits;
+		r->consumer_wait_seconds = pipeline->consumer_wait_seconds;
+		delete pipeline;
+	} else {
+		reader->close ();
+		delete reader;
+	}
+	for (size_t i=0; i<np; i++) delete p[i];
+	r->seconds = now_seconds () - start_time;
+}
+
+// give mispredictions per kilo-instruction.  each trace represents 
+// exactly 100 million instructions.
+
+static double mpki (const predictor_stats & s) {
+	// logfile << "dmiss: " << s.dmiss << " " << s.total_conditional << std::endl;
+	// logfile << "tmiss: " << s.tmiss << " " << s.total_indirect << std::endl;
+	// logfile << "total branches: " << s.total_branches << std::endl;
+	// logfile << "total miss: " << s.dmiss + s.tmiss << std::endl << std::endl;
+
+	return 1000.0 * (s.dmiss / 1e8);
+	// return 1000.0 * (s.tmiss / 1e8);
+	// return 1000.0 * ((s.dmiss + s.tmiss) / 1e8);
+}
 
-		if (t->bi.br_flags & BR_CONDITIONAL) {
-			
-			// logfile << (u->direction_prediction () == t->taken) << std::endl;
+static double target_mpki (const predictor_stats & s) {
+	return 1000.0 * (s.tmiss / 1e8);
+}
 
-			// count a direction misprediction
-			total_conditional++;
+static double class_target_mpki (const predictor_stats & s, int c) {
+	return 1000.0 * (s.class_tmiss[c] / 1e8);
+}
 
-			dmiss += u->direction_prediction () != t->taken;
+static off_t file_size (const char *fname) {
+	struct stat st;
+	return stat (fname, &st) == 0 ? st.st_size : 0;
+}
 
-			// if (logfile.is_open()) {
-			// 	logfile << t->bi.address << " " << t->taken << " " << u->direction_prediction () << "\n";
-			// }
+// with -v, give the time each predictor took per branch over all the
+// traces
+
+static void report_timing (const std::vector<sim_result> & results) {
+	if (!timing) return;
+	for (size_t k=0; k<predictors.size (); k++) {
+		double seconds = 0;
+		long long int simulated = 0;
+		for (auto & r : results) {
+			seconds += r.stats[k].seconds;
+			simulated += r.stats[k].simulated;
 		}
+		fprintf (stderr, "%-12s %8.3f s %8.2f ns/branch (%s calls)\n", predictors[k]->name, 
+			seconds, 1e9 * seconds / simulated, virtual_calls ? "virtual" : "direct");
+	}
+}
 
-		// collect statistics for an indirect branch trace
+// with -b, give each predictor's target MPKI for each class of branch,
+// averaged over the traces, and the share of the branches in each class
+
+static void report_classes (const std::vector<sim_result> & results) {
+	if (!by_class) return;
+	long long int branches[NUM_BRANCH_CLASSES] = { 0 }, total = 0;
+	for (auto & r : results)
+		for (int c=0; c<NUM_BRANCH_CLASSES; c++) {
+			branches[c] += r.stats[0].class_branches[c];
+			total += r.stats[0].class_branches[c];
+		}
+	printf ("%-12s", "target MPKI");
+	for (int c=0; c<NUM_BRANCH_CLASSES; c++) printf (" %8s", branch_class_names[c]);
+	printf ("\n%-12s", "% branches");
+	for (int c=0; c<NUM_BRANCH_CLASSES; c++) printf (" %8.2f", total ? 100.0 * branches[c] / total : 0);
+	printf ("\n");
+	for (size_t k=0; k<predictors.size (); k++) {
+		printf ("%-12s", predictors[k]->name);
+		for (int c=0; c<NUM_BRANCH_CLASSES; c++) {
+			double sum = 0;
+			for (auto & r : results) sum += class_target_mpki (r.stats[k], c);
+			printf (" %8.3f", sum / results.size ());
+		}
+		printf ("\n");
+	}
+}
 
-		if (t->bi.br_flags & BR_INDIRECT) {
-			// logfile << (u->target_prediction () == t->target) << std::endl;
-			// count a target misprediction
-			total_indirect++;
+// parse a comma-separated list of predictor names into predictors
 
-			tmiss += u->target_prediction () != t->target;
+static void parse_predictors (const char *list) {
+	if (!strcmp (list, "list")) {
+		for (size_t i=0; i<NUM_PREDICTORS; i++)
+			printf ("%-12s %s\n", predictor_table[i].name, predictor_table[i].description);
+		exit (0);
+	}
+	predictors.clear ();
+	std::string names (list);
+	size_t pos = 0;
+	for (;;) {
+		size_t comma = names.find (',', pos);
+		std::string name = names.substr (pos, comma == std::string::npos ? std::string::npos : comma - pos);
+		const predictor_entry *e = find_predictor (name.c_str ());
+		if (!e) {
+			fprintf (stderr, "unknown predictor \"%s\"; try -P list\n", name.c_str ());
+			exit (1);
 		}
+		predictors.push_back (e);
+		if (comma == std::string::npos) break;
+		pos = comma + 1;
+	}
+}
 
-		// update competitor's state
+int main (int argc, char *argv[]) {	
 
-		p->update (u, t->taken, t->target);
+	int c, jobs = std::max (1u, std::thread::hardware_concurrency ());
+	const char *usage = "Usage: %s [-j jobs] [-P predictor,...] [-p] [-v] [-V] [-S seed] [-b] [-c cachedir] [-t threads] [-T] [-s first] [-n count] [-w warm] [-C dir] [-L dir] <filename>.gz ...\n";
+
+	while ((c = getopt (argc, argv, "j:P:pvVS:bc:t:Ts:n:w:C:L:")) != -1) {
+		switch (c) {
+		case 'j': jobs = atoi (optarg); break;
+		case 'P': parse_predictors (optarg); break;
+		case 'p': thread_per_predictor = true; break;
+		case 'v': timing = true; break;
+		case 'V': virtual_calls = true; break;
+		case 'S': random_seed = strtoul (optarg, NULL, 0); break;
+		case 'b': by_class = true; break;
+		case 'c': trace_cache_dir = optarg; break;
+		case 't': trace_threads = atoi (optarg); break;
+		case 'T': pipelined = true; break;
+		case 's': first = strtoull (optarg, NULL, 0); break;
+		case 'n': count = strtoull (optarg, NULL, 0); break;
+		case 'w': warm = strtoull (optarg, NULL, 0); break;
+		case 'C': save_dir = optarg; break;
+		case 'L': load_dir = optarg; break;
+		default:
+			fprintf (stderr, usage, argv[0]);
+			exit (1);
+		}
 	}
 
-	// logfile.close();
+	// make sure there is at least one parameter
+	if (optind == argc || jobs < 1) {
+		fprintf (stderr, usage, argv[0]);
+		exit (1);
+	}
+	if (predictors.empty ()) predictors.push_back (find_predictor ("my"));
 
-	// done reading traces
+	// a checkpoint is the warm-up, and every predictor has to be able to
+	// go into one; find out now rather than after simulating
 
-	end_trace ();
+	if (load_dir && warm) {
+		fprintf (stderr, "-w and -L don't go together; the checkpoint is the warm-up\n");
+		exit (1);
+	}
+	if (save_dir || load_dir)
+		for (size_t k=0; k<predictors.size (); k++) {
+			branch_predictor *q = predictors[k]->make ();
+			predictor_state s;
+			bool ok = q->checkpoint (s);
+			delete q;
+			if (!ok) {
+				fprintf (stderr, "%s can't be checkpointed\n", predictors[k]->name);
+				exit (1);
+			}
+		}
+
+	int ntraces = argc - optind;
+	size_t np = predictors.size ();
+	char **fnames = &argv[optind];
+	std::vector<sim_result> results (ntraces);
+
+	// with only one trace, just simulate it and give the MPKI
+
+	if (ntraces == 1) {
+		sim_result & r = results[0];
+		simulate (fnames[0], &r);
+		if (pipelined) {
+			fprintf (stderr, "decode thread stalled on full ring: %lld times, %0.3f s\n",
+				r.producer_stalls, r.producer_stall_seconds);
+			fprintf (stderr, "simulator waited on empty ring: %lld times, %0.3f s\n",
+				r.consumer_waits, r.consumer_wait_seconds);
+		}
+		if (np == 1)
+			printf ("%0.3f MPKI\n", mpki (r.stats[0]));
+		else
+			for (size_t k=0; k<np; k++)
+				printf ("%-12s %0.3f MPKI %0.3f target MPKI\n", 
+					predictors[k]->name, mpki (r.stats[k]), target_mpki (r.stats[k]));
+		report_classes (results);
+		report_timing (results);
+		exit (0);
+	}
 
-	total_misses = dmiss + tmiss;
+	// otherwise start the biggest traces first; the size of the
+	// compressed file is a good enough guess at how long a trace takes
 
-	// logfile << "dmiss: " << dmiss << " " << total_conditional << std::endl;
-	// logfile << "tmiss: " << tmiss << " " << total_indirect << std::endl;
-	// logfile << "total branches: " << total_branches << std::endl;
-	// logfile << "total miss: " << total_misses << std::endl << std::endl;
+	std::vector<int> order (ntraces);
+	std::vector<off_t> sizes (ntraces);
+	for (int i=0; i<ntraces; i++) {
+		order[i] = i;
+		sizes[i] = file_size (fnames[i]);
+	}
+	std::stable_sort (order.begin (), order.end (), 
+		[&] (int a, int b) { return sizes[a] > sizes[b]; });
+
+	// each worker takes the next trace nobody has started yet
+
+	std::atomic<int> next_trace (0);
+	double start = now_seconds ();
+
+	auto worker = [&] (void) {
+		int i;
+		while ((i = next_trace++) < ntraces)
+			simulate (fnames[order[i]], &results[order[i]]);
+	};
+	if (jobs > ntraces) jobs = ntraces;
+	if (jobs == 1)
+		worker ();
+	else {
+		std::vector<std::thread> threads;
+		for (int j=0; j<jobs; j++) threads.push_back (std::thread (worker));
+		for (auto & t : threads) t.join ();
+	}
+	double wall = now_seconds () - start;
 
-	// give final mispredictions per kilo-instruction and exit.
-	// each trace represents exactly 100 million instructions.
+	// report in the order the traces were given, like the run script,
+	// with a column for each predictor
 
-	printf ("%0.3f MPKI\n", 1000.0 * (dmiss / 1e8));
-	// printf ("%0.3f MPKI\n", 1000.0 * (tmiss / 1e8));
-	// printf ("%0.3f MPKI\n", 1000.0 * (total_misses / 1e8));
-	delete p;
+	if (np > 1) {
+		printf ("%-40s", "");
+		for (size_t k=0; k<np; k++) printf ("\t%s", predictors[k]->name);
+		printf ("\n");
+	}
+	std::vector<double> sum (np);
+	double all_seconds = 0;
+	for (int i=0; i<ntraces; i++) {
+		sim_result & r = results[i];
+		if (pipelined)
+			fprintf (stderr, "%s: decode thread stalled %lld times, %0.3f s; simulator waited %lld times, %0.3f s\n",
+				fnames[i], r.producer_stalls, r.producer_stall_seconds, 
+				r.consumer_waits, r.consumer_wait_seconds);
+		printf ("%-40s", fnames[i]);
+		for (size_t k=0; k<np; k++) {
+			printf ("\t%0.3f", mpki (r.stats[k]));
+			sum[k] += mpki (r.stats[k]);
+		}
+		printf ("\t%8.3f s\n", r.seconds);
+		all_seconds += r.seconds;
+	}
+	printf ("average MPKI:");
+	for (size_t k=0; k<np; k++) printf (" %0.3f", sum[k] / ntraces);
+	printf ("\n");
+	printf ("wall clock: %0.3f s for %0.3f s of simulation with %d jobs\n", wall, all_seconds, jobs);
+	report_classes (results);
+	report_timing (results);
 	exit (0);
 }
@@ -1,6 +1,11 @@
 // predictor.h
 // This file declares branch_update and branch_predictor classes.
 
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+class predictor_state;
+
 class branch_update {
 	bool _direction_prediction;
 	unsigned int _target_prediction;
@@ -21,5 +26,16 @@ class branch_predictor {
 public:
 	virtual branch_update *predict (branch_info &) = 0;
 	virtual void update (branch_update *, bool, unsigned int) {}
+
+	// reseed any random choices the predictor makes, so that runs
+	// with the same seed give the same results
+	virtual void seed (unsigned int) {}
+
+	// save the predictor's state into s, or restore it from s, which
+	// way depending on s (see checkpoint.h); false if the predictor
+	// can't be checkpointed or s doesn't hold a state it could have saved
+	virtual bool checkpoint (predictor_state &) { return false; }
 	virtual ~branch_predictor (void) {}
 };
+
+#endif // PREDICTOR_H
@@ -0,0 +1,73 @@
+// predictors.h
+// This file lists the predictors that predict can build by name, so that
+// several of them can be run side by side over one decode of a trace
+// (predict -P).  To make another predictor available, include its header
+// and add it to predictor_table.
+
+#ifndef PREDICTORS_H
+#define PREDICTORS_H
+
+#include <string.h>
+
+#include "predictor.h"
+#include "simulate.h"
+#include "my_predictor.h"
+#include "gshare.h"
+#include "perceptron.h"
+#include "tage_sc_l.h"
+
+// my_predictor with ITTAGE looking up and training on every branch, as it
+// did before it was told which branches it predicts
+class my_all_branches_predictor : public my_predictor {
+public:
+	my_all_branches_predictor (void) : my_predictor (false) {}
+};
+
+template <class P> branch_predictor *make_predictor (void) { return new P; }
+
+struct predictor_entry {
+	const char *name;
+	branch_predictor *(*make) (void);
+	block_simulator simulate;	// simulate_block for this type
+	const char *description;
+};
+
+#define PREDICTOR(name, type, description) \
+	{ name, make_predictor<type>, simulate_block<type>, description }
+
+static const predictor_entry predictor_table[] = {
+	PREDICTOR ("my",	my_predictor,		"my_predictor.h: TAGE for directions, RAS/ITTAGE/BTB for targets"),
+	PREDICTOR ("my-all",	my_all_branches_predictor, "my_predictor.h: my, with ITTAGE working on every branch"),
+	PREDICTOR ("my-sc-l",	my_sc_l_predictor,	"my_predictor.h: my, with TAGE-SC-L for directions"),
+	PREDICTOR ("tage",	tage_predictor,		"tage.h: TAGE alone"),
+	PREDICTOR ("ittage",	ittage_predictor,	"ittage.h: ITTAGE alone (targets only)"),
+	PREDICTOR ("tage-wide",	wide_tage_predictor,	"tage.h: TAGE with 12-byte unpacked entries"),
+	PREDICTOR ("ittage-wide", wide_ittage_predictor,	"ittage.h: ITTAGE with 16-byte unpacked entries"),
+	PREDICTOR ("tage-8",	tage8_predictor,	"tage.h: TAGE with 8 2K-entry tables, histories 4..640"),
+	PREDICTOR ("tage-12",	tage12_predictor,	"tage.h: TAGE with 12 1K-entry tables, histories 4..1000"),
+	PREDICTOR ("tage-7",	tage7_predictor,	"tage.h: TAGE with 7 2K-entry tables and 13bit tags, in tage-sc-l's budget"),
+	PREDICTOR ("tage-sc-l",	tage_sc_l_predictor,	"tage_sc_l.h: TAGE with a statistical corrector and a loop predictor"),
+	PREDICTOR ("loop",	loop_predictor,		"loop_predictor.h: loop predictor alone"),
+	PREDICTOR ("loop-4k",	loop4k_predictor,	"loop_predictor.h: loop predictor alone, 8-way with 4K entries"),
+	PREDICTOR ("perceptron", perceptron_predictor,	"perceptron.h: hashed perceptron in 32KB (15 x 2K + 1K weights)"),
+	PREDICTOR ("perceptron-64", perceptron64_predictor, "perceptron.h: hashed perceptron in 64KB (15 x 4K + 2K weights)"),
+	PREDICTOR ("btb",	btb_predictor,		"btb.h: 4-way 4K-entry BTB alone, for every branch"),
+	PREDICTOR ("ras",	ras_predictor,		"ras.h: 16-entry return address stack alone"),
+	PREDICTOR ("gshare",	gshare_predictor,	"gshare.h: 15-bit gshare"),
+	PREDICTOR ("gshare-20",	gshare20_predictor,	"gshare.h: 20-bit gshare (256KB of counters)"),
+	PREDICTOR ("gselect",	gselect_predictor,	"gshare.h: gselect, 7 address bits and 8 history bits"),
+	PREDICTOR ("bimodal",	bimodal_predictor,	"gshare.h: 32K 2-bit counters indexed by address"),
+	PREDICTOR ("agree",	agree_predictor,	"gshare.h: 15-bit agree predictor"),
+};
+
+#define NUM_PREDICTORS	(sizeof (predictor_table) / sizeof (predictor_table[0]))
+
+// find a predictor by name; NULL if there isn't one
+
+static inline const predictor_entry *find_predictor (const char *name) {
+	for (size_t i=0; i<NUM_PREDICTORS; i++)
+		if (!strcmp (predictor_table[i].name, name)) return &predictor_table[i];
+	return NULL;
+}
+
+#endif // PREDICTORS_H
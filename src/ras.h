@@ -0,0 +1,95 @@
+// ras.h
+// This file contains a return address stack.  A call pushes the address
+// it will return to and a return pops it to predict its target.  When the
+// stack is full a call overwrites the oldest entry, as it would in
+// hardware, so deep recursion only costs the returns at the bottom.
+
+#ifndef RAS_H
+#define RAS_H
+
+#include "branch.h"
+#include "predictor.h"
+#include "checkpoint.h"
+#include <string.h>
+
+#define RAS_DEPTH		16	// entries in the return address stack
+
+// the traces don't record instruction lengths, which hardware would know.
+// the first time a call is seen its length is guessed the way the trace
+// compressor guesses it (see trace.cc), 5 bytes for a direct call and 2
+// for an indirect one; after that the length its return went back to is
+// remembered in a small table indexed by the call's address.
+
+#define DIRECT_CALL_LENGTH	5
+#define INDIRECT_CALL_LENGTH	2
+#define CALL_LENGTH_LOG_SIZE	12	// 2^12 remembered call lengths
+
+template <int Depth = RAS_DEPTH>
+class return_stack : public branch_predictor {
+	struct frame {
+		unsigned int call;	// address of the call
+		unsigned int ret;	// where it should return to
+	};
+
+	frame stack[Depth];
+	int top;	// where the next push goes
+	int depth;	// valid entries, at most Depth
+
+	// learned call lengths; 0 if unknown
+	unsigned char call_length[1 << CALL_LENGTH_LOG_SIZE];
+
+	static unsigned int length_index (unsigned int address) {
+		return (address ^ (address >> CALL_LENGTH_LOG_SIZE)) & ((1 << CALL_LENGTH_LOG_SIZE) - 1);
+	}
+
+public:
+	branch_update u;
+	branch_info bi;
+
+	return_stack (void) : top(0), depth(0) {
+		memset (stack, 0, sizeof (stack));
+		memset (call_length, 0, sizeof (call_length));
+		u.direction_prediction (true);
+	}
+
+	bool checkpoint (predictor_state & s) {
+		s.array (stack, Depth);
+		s.value (top);
+		s.value (depth);
+		s.array (call_length, sizeof (call_length));
+		return s.complete ();
+	}
+
+	branch_update *predict (branch_info & b) {
+		bi = b;
+		if ((b.br_flags & BR_RETURN) && depth)
+			u.target_prediction (stack[(top + Depth - 1) % Depth].ret);
+		else
+			u.target_prediction (0);
+		return &u;
+	}
+
+	void update (branch_update *, bool, unsigned int target) {
+		if (bi.br_flags & BR_CALL) {
+			unsigned int length = call_length[length_index (bi.address)];
+			if (!length) length = (bi.br_flags & BR_INDIRECT) ? INDIRECT_CALL_LENGTH : DIRECT_CALL_LENGTH;
+			stack[top].call = bi.address;
+			stack[top].ret = bi.address + length;
+			top = (top + 1) % Depth;
+			if (depth < Depth) depth++;
+		} else if ((bi.br_flags & BR_RETURN) && depth) {
+			top = (top + Depth - 1) % Depth;
+			depth--;
+
+			// a return just past its call tells us how long the call is;
+			// x86 instructions are at most 15 bytes
+			unsigned int length = target - stack[top].call;
+			if (length >= 1 && length <= 15)
+				call_length[length_index (stack[top].call)] = length;
+		}
+	}
+};
+
+typedef return_stack<> ras_predictor;
+
+#endif // RAS_H
@@ -0,0 +1,165 @@
+// simulate.h
+// This file contains the loop that feeds a block of branches to a
+// predictor and counts its mispredictions.
+//
+// simulate_block<P> calls P's predict and update directly rather than
+// through the virtual functions in branch_predictor, so the compiler can
+// inline them into the loop.  simulate_block<branch_predictor> goes
+// through the virtual functions, so it works for any predictor, e.g. one
+// that isn't known until run time.
+
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include "branch.h"
+#include "trace.h"
+#include "predictor.h"
+
+// kinds of branch, for counting target mispredictions of each
+
+enum branch_class {
+	BC_CONDITIONAL,
+	BC_JUMP,		// direct unconditional jump
+	BC_INDIRECT_JUMP,
+	BC_CALL,
+	BC_INDIRECT_CALL,
+	BC_RETURN,
+	NUM_BRANCH_CLASSES
+};
+
+static const char *const branch_class_names[NUM_BRANCH_CLASSES] = {
+	"cond", "jump", "ijump", "call", "icall", "return"
+};
+
+// the class of each combination of BR_ flags.  a return is a return and
+// a call a call, whatever else they are; otherwise indirect beats
+// conditional.
+
+static const unsigned char branch_class_of[16] = {
+	BC_JUMP, BC_CONDITIONAL, BC_INDIRECT_JUMP, BC_INDIRECT_JUMP,
+	BC_CALL, BC_CALL, BC_INDIRECT_CALL, BC_INDIRECT_CALL,
+	BC_RETURN, BC_RETURN, BC_RETURN, BC_RETURN,
+	BC_RETURN, BC_RETURN, BC_RETURN, BC_RETURN
+};
+
+static inline int classify_branch (unsigned int br_flags) {
+	return branch_class_of[br_flags & 15];
+}
+
+// statistics for one predictor on one trace
+
+struct predictor_stats {
+	long long int 
+		tmiss, 		// number of target mispredictions
+		dmiss, 		// number of direction mispredictions
+		total_branches,
+		total_conditional,
+		total_indirect;
+
+	// branches of each class, and how many of them were taken to
+	// somewhere other than the predicted target.  tmiss only counts
+	// indirect branches, as the competition did.
+
+	long long int
+		class_branches[NUM_BRANCH_CLASSES],
+		class_tmiss[NUM_BRANCH_CLASSES];
+
+	// time spent in simulate_block, and the branches it was given,
+	// counting warm-up branches
+
+	double seconds;
+	long long int simulated;
+
+	predictor_stats (void) : 
+		tmiss(0), dmiss(0), total_branches(0), total_conditional(0), 
+		total_indirect(0), seconds(0), simulated(0) {
+		for (int i=0; i<NUM_BRANCH_CLASSES; i++)
+			class_branches[i] = class_tmiss[i] = 0;
+	}
+};
+
+// how simulate_block calls P.  a qualified call to P's own predict and
+// update can't be virtual; the base class has to be called through the
+// vtable since its functions are pure.
+
+template <class P> struct predictor_calls {
+	static branch_update *predict (P *p, branch_info & b) { return p->P::predict (b); }
+	static void update (P *p, branch_update *u, bool taken, unsigned int target) { p->P::update (u, taken, target); }
+};
+
+template <> struct predictor_calls<branch_predictor> {
+	static branch_update *predict (branch_predictor *p, branch_info & b) { return p->predict (b); }
+	static void update (branch_predictor *p, branch_update *u, bool taken, unsigned int target) { p->update (u, taken, target); }
+};
+
+// feed a block of n traces to one predictor, which must really be a P.
+// position is the number of the first branch in the block; branches
+// before first only warm the predictor up.
+
+template <class P>
+void simulate_block (branch_predictor *bp, predictor_stats *s, trace *block, size_t n, unsigned long long position, unsigned long long first) {
+	typedef predictor_calls<P> call;
+	P *p = static_cast<P *> (bp);
+
+	for (size_t i=0; i<n; i++, position++) {
+
+		// get a trace
+
+		trace *t = &block[i];
+
+		// send this trace to the competitor's code for prediction
+
+		branch_update *u = call::predict (p, t->bi);
+
+		// warm-up branches only train the predictor
+
+		if (position < first) {
+			call::update (p, u, t->taken, t->target);
+			continue;
+		}
+
+		// collect statistics for a conditional branch trace
+
+		s->total_branches++;
+
+		// compare to gshare mispredictions for dmiss and tmiss
+
+		if (t->bi.br_flags & BR_CONDITIONAL) {
+		
+			// logfile << (u->direction_prediction () == t->taken) << std::endl;
+
+			// count a direction misprediction
+			s->total_conditional++;
+
+			s->dmiss += u->direction_prediction () != t->taken;
+
+			// if (logfile.is_open()) {
+			// 	logfile << t->bi.address << " " << t->taken << " " << u->direction_prediction () << "\n";
+			// }
+		}
+
+		// collect statistics for an indirect branch trace
+
+		if (t->bi.br_flags & BR_INDIRECT) {
+			// logfile << (u->target_prediction () == t->target) << std::endl;
+			// count a target misprediction
+			s->total_indirect++;
+
+			s->tmiss += u->target_prediction () != t->target;
+		}
+
+		// a not-taken conditional branch's target doesn't matter
+
+		int c = classify_branch (t->bi.br_flags);
+		s->class_branches[c]++;
+		s->class_tmiss[c] += t->taken && u->target_prediction () != t->target;
+
+		// update competitor's state
+
+		call::update (p, u, t->taken, t->target);
+	}
+}
+
+typedef void (*block_simulator) (branch_predictor *, predictor_stats *, trace *, size_t, unsigned long long, unsigned long long);
+
+#endif // SIMULATE_H
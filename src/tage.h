@@ -1,8 +1,11 @@
 // Predictor 2: TAGE
 
+#ifndef TAGE_H
+#define TAGE_H
+
 #include <cstdint>
-#include <bitset>
 #include <algorithm>
+#include <type_traits>
 #include "tools.h"
 
 #define BIMODAL_CTR_MAX		3	// 2bit counter (as per paper); 00 ... 11;  
@@ -15,36 +18,147 @@
 #define TAGE_COMP_LOG_SIZE	12	// 2^12 entries in a TAGE component
 #define U_CTR_MAX			3	// 2bit counter (as per paper); 00 ... 11; 
 
-// Entry in a TAGE component
+#define TAGE_TAG_BITS		9	// Bits of tag in a TAGE entry (as per PPM paper)
+
+// Entry in a TAGE component.  The predictor only touches entries through
+// the get/set functions, so the layout is a template parameter of
+// the tage template (see tage_config).
+
+// One word per field; 12 bytes
 struct TagEntry {
     INT32 ctr;	// 3bit predictor
     UINT32 tag;	// Unique tag
     INT32 u;	// 2bit useful counter
+
+    INT32 getCtr() const { return ctr; }
+    UINT32 getTag() const { return tag; }
+    INT32 getU() const { return u; }
+    void setCtr(INT32 v) { ctr = v; }
+    void setTag(UINT32 v) { tag = v; }
+    void setU(INT32 v) { u = v; }
+};
+
+// ctr, u and a TagBits-bit tag packed into one Word, from the low bits up;
+// 2 bytes for the default 9-bit tags
+template <int TagBits, class Word = uint16_t>
+struct PackedTagEntry {
+    static_assert(3 + 2 + TagBits <= 8 * sizeof(Word), "tag doesn't fit in the entry");
+    Word bits;
+
+    INT32 getCtr() const { return bits & 7; }
+    INT32 getU() const { return (bits >> 3) & 3; }
+    UINT32 getTag() const { return bits >> 5; }
+    void setCtr(INT32 v) { bits = (bits & ~(Word) 7) | (v & 7); }
+    void setU(INT32 v) { bits = (bits & ~(Word) (3 << 3)) | ((v & 3) << 3); }
+    void setTag(UINT32 v) { bits = (bits & (Word) 31) | (Word) ((v & ((1u << TagBits) - 1)) << 5); }
 };
 
 int satIncrement(UINT32 value, UINT32 max) { return (value < max) ? value + 1 : value; }
 
 int satDecrement(UINT32 value) { return (value > 0) ? value - 1 : value; }
 
-class tage_predictor : public branch_predictor {
+// The entry layout for a given tag width: packed into 16 bits if it fits,
+// otherwise 32
+template <int TagBits>
+struct tage_entry {
+	typedef PackedTagEntry<TagBits, typename std::conditional<(3 + 2 + TagBits <= 16), uint16_t, uint32_t>::type> type;
+};
+
+// A TAGE configuration: the number of tagged tables, log2 of the entries
+// in each, the tag width, and the shortest and longest global history
+// lengths; the tables' lengths are a geometric series between the two,
+// longest first.  Entry is the table entry layout.  The defaults are the
+// 4-table predictor with lengths {128, 32, 8, 2} this file started with.
+template <int Tables = NUM_TAGE_TABLES, int LogSize = TAGE_COMP_LOG_SIZE, int TagBits = TAGE_TAG_BITS,
+	int MinHist = 2, int MaxHist = 128, class E = typename tage_entry<TagBits>::type>
+struct tage_config {
+	static constexpr int numTables = Tables;
+	static constexpr int logSize = LogSize;
+	static constexpr int tagBits = TagBits;
+	static constexpr int minHist = MinHist;
+	static constexpr int maxHist = MaxHist;
+	typedef E Entry;
+
+	static_assert(Tables >= 1 && MinHist >= 1 && MinHist <= MaxHist, "bad TAGE configuration");
+	static_assert(TagBits >= 3, "tags are hashed from two folded histories of TagBits-1 and TagBits-2 bits");
+};
+
+// Compile-time helpers for the geometric series
+
+constexpr double tage_pow (double b, int n) {
+	double r = 1;
+	for (int i = 0; i < n; i++) r *= b;
+	return r;
+}
+
+// r with r^n == x, for x >= 1, by bisection
+constexpr double tage_root (double x, int n) {
+	double lo = 1, hi = x;
+	for (int k = 0; k < 200; k++) {
+		double mid = (lo + hi) / 2;
+		if (tage_pow (mid, n) < x) lo = mid; else hi = mid;
+	}
+	return lo;
+}
+
+template <class Config>
+class tage : public branch_predictor {
+public:
+	static constexpr int NumTables = Config::numTables;
+	static constexpr int LogSize = Config::logSize;
+	static constexpr int TagBits = Config::tagBits;
+	typedef typename Config::Entry Entry;
+	typedef HistoryProvider<std::max (HIST_BUFFER_LOG, floorLog2 (Config::maxHist) + 1)> History;
+
+	// History length of T[i]; T0 is longest
+	static constexpr UINT32 historyLength (int i) {
+		return NumTables == 1 ? Config::maxHist
+			: (UINT32) (Config::minHist * tage_pow (tage_root ((double) Config::maxHist / Config::minHist, NumTables - 1), NumTables - 1 - i) + 0.5);
+	}
+
+	// Bits of path history hashed into T[i]'s index: all 16 for tables
+	// with at least that much global history, otherwise 2 more than
+	// log2 of the length.  T0 folds the whole register into its index.
+	static constexpr UINT32 pathMask (int i) {
+		return historyLength (i) >= 16 ? 0xffff : (1 << (floorLog2 (historyLength (i)) + 2)) - 1;
+	}
+
+	// Bits of state: the bimodal counters, ctr, u and tag in each tagged
+	// entry, and the global and path history
+	static constexpr long StorageBits = (1L << BIMODAL_LOG_SIZE) * 2
+		+ (long) NumTables * (1L << LogSize) * (3 + 2 + TagBits) + Config::maxHist + 16;
+
 private:
-	// Histories
-	std::bitset<GHIST_SIZE> GHR;	// Global history register
-	int PHR;						// 16bit path history register
+	struct Lengths {
+		UINT32 history[NumTables];
+		UINT32 pathMask[NumTables];
+		constexpr Lengths () : history(), pathMask() {
+			for (int i = 0; i < NumTables; i++) {
+				history[i] = historyLength (i);
+				pathMask[i] = tage::pathMask (i);
+			}
+		}
+	};
+	static constexpr Lengths lengths = Lengths ();
+
+	// Histories; our own unless a composite predictor shares its own
+	History ownHistory;
+	History *history;
+	bool sharedHistory;
 	
 	// Bimodal Base Predictor
 	UINT32 *bimodal;			// Pattern history table (pht)
 	UINT32 numBimodalEntries;	// Total entries in pht 
 	
 	// Tagged Predictors
-	TagEntry *tagePred[NUM_TAGE_TABLES];	// TAGE tables; T[4]
+	Entry *tagePred[NumTables];		// TAGE tables; T[4]
 	UINT32 numTagPredEntries;				// Total entries in TAGE table
-	UINT32 index[NUM_TAGE_TABLES];			// Calculated index for T[i]
-	UINT32 tag[NUM_TAGE_TABLES];			// Calculated tag for that index in T[i]
+	UINT32 index[NumTables];			// Calculated index for T[i]
+	UINT32 tag[NumTables];			// Calculated tag for that index in T[i]
 	
-	// Compressed Buffers
-	FoldedHist indexComp[NUM_TAGE_TABLES];
-	FoldedHist tagComp[2][NUM_TAGE_TABLES]; 
+	// Compressed histories, kept in history
+	const UINT32 *indexComp[NumTables];
+	const UINT32 *tagComp[2][NumTables];
 
 	// Predictions
 	bool providerPred;		// Prediction of the provider component
@@ -52,16 +166,21 @@ private:
 	int providerComp;		// Provider component
 	int altComp;			// Alternate component
 	INT32 altBetterCount;	// Times that the alternate prediction was better
+	int predConf;			// How far the counter behind the prediction is from flipping; 0..3
+
+	// Random numbers for choosing where to allocate
+	RandomGen rng;
 
 	// Clock for resetting
 	UINT32 clock;
-	int clock_flip;
+	UsefulAging<Entry, NumTables> aging;
 
 public:
 	branch_update u;
 	branch_info bi;
 
-	tage_predictor (void) { 
+	// Subscribe to shared, which the caller updates after each conditional branch, if given
+	tage (History *shared = 0) : history(shared ? shared : &ownHistory), sharedHistory(shared != 0) { 
 
 		// Initialize bimodal predictors
 		numBimodalEntries = (1 << BIMODAL_LOG_SIZE);
@@ -71,57 +190,70 @@ public:
 			bimodal[i] = BIMODAL_CTR_INIT;
 		
 		// Initialize tagged predictors 
-		numTagPredEntries = (1 << TAGE_COMP_LOG_SIZE);
+		numTagPredEntries = (1 << LogSize);
 
-		for(UINT32 i = 0; i < NUM_TAGE_TABLES; i++) {
-			tagePred[i] = new TagEntry[numTagPredEntries];
+		for(UINT32 i = 0; i < NumTables; i++) {
+			tagePred[i] = new Entry[numTagPredEntries];
 
 			for(UINT32 j = 0; j < numTagPredEntries; j++) {
-				tagePred[i][j].ctr = TAGEPRED_CTR_INIT;
-				tagePred[i][j].tag = 0;
-				tagePred[i][j].u = 0;
+				tagePred[i][j].setCtr(TAGEPRED_CTR_INIT);
+				tagePred[i][j].setTag(0);
+				tagePred[i][j].setU(0);
 			}
 		}
 
 		// Initialize stored indices and tags
-		for(int i=0; i < NUM_TAGE_TABLES; i++) {
+		for(int i=0; i < NumTables; i++) {
 			index[i] = 0;
 			tag[i] = 0;
 		}
 
-		// Geometric lengths of history, T0 is longest
-		UINT32 geometric[NUM_TAGE_TABLES] = { 128, 32, 8, 2};
-
 		// Initialize compressed buffers for indices 
-		for(int i = 0; i < NUM_TAGE_TABLES; i++) {
-			indexComp[i].geomLength = geometric[i];
-			indexComp[i].targetLength = TAGE_COMP_LOG_SIZE;
-			indexComp[i].compHist = 0;
-		}
+		for(int i = 0; i < NumTables; i++)
+			indexComp[i] = history->subscribe(lengths.history[i], LogSize);
 
 		// Initialize compressed buffers for tags
-        // From PPM paper, tagComp[0] has 8bits and tagComp[1] has 7 bits
+        // From PPM paper, tagComp[0] has 8bits and tagComp[1] has 7 bits (for 9bit tags)
         for(int j = 0; j < 2 ; j++) {
-        	for(int i = 0; i < NUM_TAGE_TABLES; i++) {
-				tagComp[j][i].geomLength = geometric[i];
-				tagComp[j][i].targetLength = (j == 0) ? 8 : 7;
-				tagComp[j][i].compHist = 0;
-        	}   
+        	for(int i = 0; i < NumTables; i++)
+				tagComp[j][i] = history->subscribe(lengths.history[i], (j == 0) ? TagBits - 1 : TagBits - 2);
     	}
 
 		// Predictions banks and values 
 		providerPred = -1;
 		altPred = -1;
-		providerComp = NUM_TAGE_TABLES;
-		altComp = NUM_TAGE_TABLES;
+		providerComp = NumTables;
+		altComp = NumTables;
 			
 		clock = 0;
-		clock_flip = 1;
-		PHR = 0;
-		GHR.reset();
+		aging.init(tagePred, numTagPredEntries);
 		altBetterCount = 8;
+		predConf = 0;
+		rng.seed(1);
+	}
+
+	void seed (unsigned int s) { rng.seed(s); }
+
+	// Everything but the indices, tags and predictions of the branch in
+	// flight, which predict() recomputes; a shared history is left to
+	// the composite that owns it
+	bool checkpoint (predictor_state & s) {
+		s.array(bimodal, numBimodalEntries);
+		for (int i = 0; i < NumTables; i++)
+			s.array(tagePred[i], numTagPredEntries);
+		s.value(altBetterCount);
+		s.value(rng);
+		s.value(clock);
+		aging.checkpoint(s);
+		if (!sharedHistory)
+			history->checkpoint(s);
+		return s.complete();
 	}
 
+	// Confidence of the last conditional prediction, from 0 (the counter
+	// it came from is next to flipping) to 3; for a statistical corrector
+	int confidence (void) const { return predConf; }
+
 	branch_update *predict (branch_info & b) {
 		bi = b;
 		if (b.br_flags & BR_CONDITIONAL) {
@@ -134,62 +266,61 @@ public:
 			basePrediction = (bimodalCounter > BIMODAL_CTR_MAX/2) ? TAKEN : NOT_TAKEN;
 
 			// Compute tag according to PPM paper: pc[9:0] ⊕ CSR1 ⊕ (CSR2 << 1)
-			for (int i = 0; i < NUM_TAGE_TABLES; i++) {
-				tag[i] = b.address ^ tagComp[0][i].compHist ^ (tagComp[1][i].compHist << 1);
-				tag[i] &= ((1 << 9) - 1);
+			for (int i = 0; i < NumTables; i++) {
+				tag[i] = b.address ^ *tagComp[0][i] ^ (*tagComp[1][i] << 1);
+				tag[i] &= ((1 << TagBits) - 1);
 			}
 			
 			// Compute index for each table according to PPM paper: pc[9:0] ⊕ pc[19:10] ⊕ ghist ⊕ phist
-			index[0] = b.address ^ (b.address >> TAGE_COMP_LOG_SIZE) ^ indexComp[0].compHist ^ PHR ^ (PHR >> TAGE_COMP_LOG_SIZE);
-       		index[1] = b.address ^ (b.address >> TAGE_COMP_LOG_SIZE) ^ indexComp[1].compHist ^ (PHR);
-       		index[2] = b.address ^ (b.address >> TAGE_COMP_LOG_SIZE) ^ indexComp[2].compHist ^ (PHR & 31);
-       		index[3] = b.address ^ (b.address >> TAGE_COMP_LOG_SIZE) ^ indexComp[3].compHist ^ (PHR & 7);
+			int PHR = history->PHR;
+			index[0] = b.address ^ (b.address >> LogSize) ^ *indexComp[0] ^ PHR ^ (PHR >> LogSize);
+			for (int i = 1; i < NumTables; i++)
+				index[i] = b.address ^ (b.address >> LogSize) ^ *indexComp[i] ^ (PHR & lengths.pathMask[i]);
 			
-			UINT32 index_mask = ((1 << TAGE_COMP_LOG_SIZE) - 1);
-			for(int i = 0; i < NUM_TAGE_TABLES; i++)
+			UINT32 index_mask = ((1 << LogSize) - 1);
+			for(int i = 0; i < NumTables; i++) {
             	index[i] &= index_mask;
+				aging.sync(i, index[i]);	// catch up on resets before using u
+			}
 			
 			// Set the provider and alternate predictions
 			providerPred = -1;
 			altPred = -1;
-			providerComp = NUM_TAGE_TABLES;
-			altComp = NUM_TAGE_TABLES;
-
-			// See if any tags match for the provider component; T0 would be best
-			for(int i = 0; i < NUM_TAGE_TABLES; i++) {
-            	if(tagePred[i][index[i]].tag == tag[i]) {
-					providerComp = i;
-					break;
-				}  
-       		}      
-            
-			// See if any tags match for alternate predictor
-			for(int i = providerComp + 1; i < NUM_TAGE_TABLES; i++) {
-                if (tagePred[i][index[i]].tag == tag[i]) {
-                    altComp = i;
-                    break;
-                }  
-            }
-
-			if (providerComp < NUM_TAGE_TABLES) {	// Provider component found
-
-				if(altComp == NUM_TAGE_TABLES)
+
+			// Compare every table's tag at once; the provider is the first
+			// match (T0 would be best) and the alternate the next
+			UINT32 stored[NumTables];
+			for(int i = 0; i < NumTables; i++)
+				stored[i] = tagePred[i][index[i]].getTag();
+
+			UINT32 hits = tagMatchMask<NumTables>(stored, tag);
+			providerComp = firstMatch(hits, NumTables);
+			altComp = firstMatch(hits & (hits - 1), NumTables);
+
+			if (providerComp < NumTables) {	// Provider component found
+
+				if(altComp == NumTables)
 					altPred = basePrediction;	// Alt pred not found; use base predictor
 				else
-					altPred = (tagePred[altComp][index[altComp]].ctr >= TAGEPRED_CTR_MAX/2) ? TAKEN : NOT_TAKEN;	// Alt pred found
+					altPred = (tagePred[altComp][index[altComp]].getCtr() >= TAGEPRED_CTR_MAX/2) ? TAKEN : NOT_TAKEN;	// Alt pred found
 			
 				// Use provider component if it wasn't newly allocated and is useful
-				if ((tagePred[providerComp][index[providerComp]].ctr != 3) || 
-					(tagePred[providerComp][index[providerComp]].ctr != 4 ) || 
-					(tagePred[providerComp][index[providerComp]].u != 0) || 
+				if ((tagePred[providerComp][index[providerComp]].getCtr() != 3) || 
+					(tagePred[providerComp][index[providerComp]].getCtr() != 4 ) || 
+					(tagePred[providerComp][index[providerComp]].getU() != 0) || 
 					(altBetterCount <= ALT_BETTER_COUNT_MAX/2)) { 
-						providerPred = (tagePred[providerComp][index[providerComp]].ctr >= TAGEPRED_CTR_MAX/2) ? TAKEN : NOT_TAKEN;
+						INT32 ctr = tagePred[providerComp][index[providerComp]].getCtr();
+						providerPred = (ctr >= TAGEPRED_CTR_MAX/2) ? TAKEN : NOT_TAKEN;
+						predConf = std::min(3, providerPred ? ctr - TAGEPRED_CTR_MAX/2 : TAGEPRED_CTR_MAX/2 - 1 - ctr);
 						u.direction_prediction(providerPred);
-				} else
+				} else {
+					predConf = 0;
 					u.direction_prediction(altPred);
+				}
 
 			} else {	// Provider component not found
 				altPred = basePrediction;
+				predConf = basePrediction ? bimodalCounter - (BIMODAL_CTR_MAX/2 + 1) : BIMODAL_CTR_MAX/2 - bimodalCounter;
 				u.direction_prediction(altPred);
 			}
 		} else
@@ -205,19 +336,19 @@ public:
 			bool allocate = false;
 
 			// First, update the provider component's useful bit and prediction counter
-			if (providerComp < NUM_TAGE_TABLES) {
+			if (providerComp < NumTables) {
 
 				if (u->direction_prediction () != altPred) {
 					if (u->direction_prediction () == taken)
-						tagePred[providerComp][index[providerComp]].u = satIncrement(tagePred[providerComp][index[providerComp]].u, static_cast<UINT32>(U_CTR_MAX));
+						tagePred[providerComp][index[providerComp]].setU(satIncrement(tagePred[providerComp][index[providerComp]].getU(), static_cast<UINT32>(U_CTR_MAX)));
 					else
-						tagePred[providerComp][index[providerComp]].u = satDecrement(tagePred[providerComp][index[providerComp]].u);
+						tagePred[providerComp][index[providerComp]].setU(satDecrement(tagePred[providerComp][index[providerComp]].getU()));
 				}
 
 				if (taken)
-					tagePred[providerComp][index[providerComp]].ctr = satIncrement(tagePred[providerComp][index[providerComp]].ctr, static_cast<UINT32>(TAGEPRED_CTR_MAX));
+					tagePred[providerComp][index[providerComp]].setCtr(satIncrement(tagePred[providerComp][index[providerComp]].getCtr(), static_cast<UINT32>(TAGEPRED_CTR_MAX)));
 				else
-					tagePred[providerComp][index[providerComp]].ctr = satDecrement(tagePred[providerComp][index[providerComp]].ctr);
+					tagePred[providerComp][index[providerComp]].setCtr(satDecrement(tagePred[providerComp][index[providerComp]].getCtr()));
 
 			} else {	// Update the base predictor's counter
 				UINT32 bimodalIndex = bi.address % numBimodalEntries;
@@ -228,11 +359,11 @@ public:
 			}
 
 			// Was the current entry that gave the prediction useful?
-			if (providerComp < NUM_TAGE_TABLES) {
+			if (providerComp < NumTables) {
 
-				if ((tagePred[providerComp][index[providerComp]].u == 0) && 
-					((tagePred[providerComp][index[providerComp]].ctr == 3) || 
-					 (tagePred[providerComp][index[providerComp]].ctr == 4))) {
+				if ((tagePred[providerComp][index[providerComp]].getU() == 0) && 
+					((tagePred[providerComp][index[providerComp]].getCtr() == 3) || 
+					 (tagePred[providerComp][index[providerComp]].getCtr() == 4))) {
 												
 					allocate = true;
 					
@@ -252,7 +383,7 @@ public:
 				if (u->direction_prediction () != taken && providerComp > 0) {		
 					for (int i = 0; i < providerComp; i++) {
 						// Find at least one entry that is not useful
-						if (tagePred[i][index[i]].u == 0) {
+						if (tagePred[i][index[i]].getU() == 0) {
 							useless_entries_found = true;
 							break;
 						}
@@ -261,26 +392,25 @@ public:
 					// All entries useful; decrease useful bits for all and do not allocate
 					if (!useless_entries_found) {
 						for (int i = providerComp - 1; i >= 0; i--)
-							tagePred[i][index[i]].u = satDecrement(tagePred[i][index[i]].u);
+							tagePred[i][index[i]].setU(satDecrement(tagePred[i][index[i]].getU()));
 					} else {
-						srand(time(NULL));
-						int randNo = rand() % 100;
+						int randNo = rng.next() % 100;
 						int count = 0;
-						int bank_store[NUM_TAGE_TABLES - 1] = {-1, -1, -1};
+						int bank_store[NumTables];
 						int matchBank = 0;
 
-						// Count number of components with a useless entry
+						// Collect the components with a useless entry, longest history (table 0) first
 						for (int i = 0; i < providerComp; i++) {
-							if (tagePred[i][index[i]].u == 0) {
+							if (tagePred[i][index[i]].getU() == 0) {
 								count++;
-								bank_store[i] = i;
+								bank_store[count - 1] = i;
 							}
 						} 
 
 						if(count == 1)
 							matchBank = bank_store[0];
 						else if (count > 1) {
-							// More than one useless bank; choose one randomly with 2/3 preference for component with longer history
+							// More than one useless bank; 2/3 of the time take the one with the shortest history, nearest the provider, as in TAGE
 							if (randNo > 33 && randNo <= 99)
 								matchBank = bank_store[(count-1)];
 							else
@@ -289,10 +419,10 @@ public:
 
 						// Allocate one entry
 						for (int i = matchBank; i > -1; i--) {
-							if ((tagePred[i][index[i]].u == 0)) { 
-								tagePred[i][index[i]].ctr = taken ? 4 : 3;	
-								tagePred[i][index[i]].tag = tag[i];
-								tagePred[i][index[i]].u = 0;
+							if ((tagePred[i][index[i]].getU() == 0)) { 
+								tagePred[i][index[i]].setCtr(taken ? 4 : 3);	
+								tagePred[i][index[i]].setTag(tag[i]);
+								tagePred[i][index[i]].setU(0);
 								break;
 							}
 						}
@@ -302,43 +432,38 @@ public:
 
 			// Periodic useful bit reset (optimizes over PPM paper)
 			clock++;
-        
-			// Every 256K instruction, clear MSB and then LSB
+			aging.scrub();
+
+			// Every 256K instruction, clear MSB and then LSB; the entries
+			// catch up as they are used (see UsefulAging)
 			if (clock == CLOCK_RESET_PERIOD) {
             	clock = 0;
-				clock_flip = (clock_flip == 1) ? 0 : 1;
-
-				if (clock_flip == 1) { // MSB turn
-					for (int j = 0; j < NUM_TAGE_TABLES; j++){    
-						for (UINT32 i = 0; i < numTagPredEntries; i++)
-							tagePred[j][i].u = tagePred[j][i].u & 1;
-					}
-            	} else { // LSB turn
-					for (int j = 0; j < NUM_TAGE_TABLES; j++) {    
-						for (UINT32 i = 0; i < numTagPredEntries; i++)
-							tagePred[j][i].u = tagePred[j][i].u & 2;
-					}
-				}
+				aging.reset();
 			}
 	
-			// Append the branch result to GHR
-			GHR = (GHR << 1);
-			if (taken)
-				GHR.set(0, 1); 
-
-			for (int i = 0; i < NUM_TAGE_TABLES; i++) {
-				indexComp[i].updateCompHist(GHR);
-				tagComp[0][i].updateCompHist(GHR);
-				tagComp[1][i].updateCompHist(GHR);
-			}
-  
-  			// Append the LSB of the address to PHR
-			PHR = (PHR << 1);
-
-			if (bi.address & 1)
-				PHR = PHR + 1;
-			
-			PHR = (PHR & ((1 << 16) - 1));  
+			// Append the branch result to GHR and the LSB of the address to PHR
+			if (!sharedHistory)
+				history->update(taken, bi.address);
 		}
 	}
-};
\ No newline at end of file
+};
+
+template <class Config> constexpr typename tage<Config>::Lengths tage<Config>::lengths;
+
+typedef tage<tage_config<> > tage_predictor;
+typedef tage<tage_config<NUM_TAGE_TABLES, TAGE_COMP_LOG_SIZE, TAGE_TAG_BITS, 2, 128, TagEntry> > wide_tage_predictor;	// the old unpacked layout
+
+static_assert(tage_predictor::historyLength (0) == 128 && tage_predictor::historyLength (1) == 32
+	&& tage_predictor::historyLength (2) == 8 && tage_predictor::historyLength (3) == 2,
+	"default TAGE history lengths changed");
+
+// Bigger configurations with longer histories, in the style of the CBP
+// TAGE predictors; 32KB and 24KB of tagged entries
+typedef tage<tage_config<8, 11, 11, 4, 640> > tage8_predictor;
+typedef tage<tage_config<12, 10, 11, 4, 1000> > tage12_predictor;
+
+// The best of the configurations tried that fit in TAGE-SC-L's budget,
+// to compare it with: 7 2K-entry tables with 13bit tags, 35.6KB in all
+typedef tage<tage_config<7, 11, 13, 4, 640> > tage7_predictor;
+
+#endif // TAGE_H
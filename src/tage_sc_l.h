@@ -0,0 +1,158 @@
+// Predictor 5: TAGE-SC-L
+
+#ifndef TAGE_SC_L_H
+#define TAGE_SC_L_H
+
+#include <type_traits>
+#include "tage.h"
+#include "perceptron.h"
+#include "loop_predictor.h"
+
+// TAGE with a statistical corrector and a loop predictor, after Seznec's
+// TAGE-SC-L.  TAGE predicts as usual.  The statistical corrector (SC) is
+// a small hashed perceptron that sees TAGE's prediction and confidence as
+// well as the global and path history, and catches the branches TAGE is
+// statistically biased on; it overrides TAGE only when a chooser counter
+// for TAGE's confidence and the SC's own margin says that pays.  Last, a
+// loop predictor with a confident entry overrides both while another
+// chooser says it's been right more than wrong when they disagreed.
+
+#define SC_CHOOSER_MAX		31	// 6bit choosers
+#define SC_CHOOSER_MIN		(-32)
+#define LOOP_CHOOSER_MAX	63	// 7bit chooser, as the loop predictor's
+#define LOOP_CHOOSER_MIN	(-64)
+
+// SC features: a table that sees TAGE's prediction and confidence, a
+// bias table, short and medium global history and the path history
+struct tage_sc_features {
+	static constexpr int numFeatures = 7;
+	static constexpr perceptron_feature features[numFeatures] = {
+		{ PF_INPUT, 0, 0 }, { PF_BIAS, 0, 0 },
+		{ PF_GHIST, 0, 8 }, { PF_GHIST, 0, 16 }, { PF_GHIST, 8, 32 }, { PF_GHIST, 16, 64 },
+		{ PF_PATH, 0, 16 }
+	};
+};
+
+template <class TageConfig = tage_config<>, class ScConfig = perceptron_config<tage_sc_features, 9>,
+	class Loop = loop_predictor>
+class tage_sc_l : public branch_predictor {
+public:
+	typedef tage<TageConfig> Tage;
+	typedef hashed_perceptron<ScConfig> Corrector;
+	typedef typename Tage::History History;
+	static_assert(std::is_same<History, typename Corrector::History>::value,
+		"TAGE and the statistical corrector must be able to share a history");
+
+	// Bits of state: the three components, less the SC's copy of the
+	// history, and the choosers
+	static constexpr long StorageBits = Tage::StorageBits + Corrector::StorageBits
+		- perceptron_max_history<ScConfig> () - 16 + Loop::StorageBits + 4 * 2 * 6 + 7;
+
+private:
+	// Histories; our own unless a composite predictor shares its own
+	History ownHistory;
+	History *history;
+	bool sharedHistory;
+
+	Tage main;		// TAGE itself
+	Corrector sc;
+	Loop loop;
+
+	branch_update *tagePred;	// TAGE's prediction
+	bool scPred;			// the prediction after the SC
+	int scSum;
+	int scChoice;			// which chooser, or -1 if the SC agreed with TAGE
+	int scChooser[4][2];		// by TAGE's confidence and the SC's margin
+	int withLoop;			// >= 0 when the loop predictor should be trusted
+
+	static void train (int & ctr, bool up, int min, int max) {
+		if (up) {
+			if (ctr < max) ctr++;
+		} else if (ctr > min)
+			ctr--;
+	}
+
+public:
+	branch_update u;
+	branch_info bi;
+
+	// Subscribe to shared, which the caller updates after each conditional branch, if given
+	tage_sc_l (History *shared = 0) : history(shared ? shared : &ownHistory), sharedHistory(shared != 0),
+		main(history), sc(history) {
+		tagePred = NULL;
+		scPred = false;
+		scSum = 0;
+		scChoice = -1;
+		for (int i = 0; i < 4; i++)
+			scChooser[i][0] = scChooser[i][1] = 0;
+		withLoop = -1;
+	}
+
+	void seed (unsigned int s) { main.seed(s); }
+
+	// The components' own checks would fail part way through the
+	// state, so only the whole is checked
+	bool checkpoint (predictor_state & s) {
+		main.checkpoint(s);
+		sc.checkpoint(s);
+		loop.checkpoint(s);
+		for (int i = 0; i < 4; i++)
+			s.array(scChooser[i], 2);
+		s.value(withLoop);
+		if (!sharedHistory)
+			history->checkpoint(s);
+		return s.complete();
+	}
+
+	branch_update *predict (branch_info & b) {
+		bi = b;
+		tagePred = main.predict(b);
+		if (!(b.br_flags & BR_CONDITIONAL)) {
+			u.direction_prediction(true);
+			u.target_prediction(0);
+			return &u;
+		}
+
+		// The SC overrides TAGE if it disagrees and the chooser agrees
+		bool t = tagePred->direction_prediction();
+		int conf = main.confidence();
+		scSum = sc.output(b, (t << 2) | conf);
+		scPred = t;
+		scChoice = -1;
+		if ((scSum >= 0) != t) {
+			int margin = scSum < 0 ? -scSum : scSum;
+			scChoice = conf * 2 + (margin > sc.threshold() / 2);
+			if (scChooser[scChoice / 2][scChoice % 2] >= 0)
+				scPred = !t;
+		}
+
+		loop.predict(b);
+		if (loop.is_valid && withLoop >= 0)
+			u.direction_prediction(loop.loop_pred);
+		else
+			u.direction_prediction(scPred);
+		u.target_prediction(0);
+		return &u;
+	}
+
+	void update (branch_update *, bool taken, unsigned int target) {
+		main.update(tagePred, taken, target);
+		if (bi.br_flags & BR_CONDITIONAL) {
+			sc.train(taken);
+			if (scChoice >= 0)
+				train(scChooser[scChoice / 2][scChoice % 2], (scSum >= 0) == taken, SC_CHOOSER_MIN, SC_CHOOSER_MAX);
+			if (loop.is_valid && loop.loop_pred != scPred)
+				train(withLoop, loop.loop_pred == taken, LOOP_CHOOSER_MIN, LOOP_CHOOSER_MAX);
+			loop.update(&loop.u, taken, target, scPred);
+			if (!sharedHistory)
+				history->update(taken, bi.address);
+		}
+	}
+};
+
+typedef tage_sc_l<> tage_sc_l_predictor;
+
+static_assert(tage7_predictor::StorageBits <= tage_sc_l_predictor::StorageBits,
+	"tage-7 no longer fits in TAGE-SC-L's budget");
+
+#endif // TAGE_SC_L_H
@@ -1,11 +1,23 @@
 #ifndef TOOLS_H
 #define TOOLS_H
 
-#include <bitset>
+#include <cstdint>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "checkpoint.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 // Common constants between TAGE and ITTAGE
 #define INT32	int32_t
 #define UINT32	uint32_t
+#define UINT8	uint8_t
 
 #define TAKEN		true
 #define NOT_TAKEN	false
@@ -13,17 +25,186 @@
 #define GHIST_SIZE	129
 
 #define ALT_BETTER_COUNT_MAX	15 			// 4bit counter for the max number of times that the alternate predictor was better
-#define CLOCK_RESET_PERIOD		256*1024	// Useful bit resets after 256K branches (as per paper)
+#define CLOCK_RESET_PERIOD		(256*1024)	// Useful bit resets after 256K branches (as per paper)
+
+// log2 of x, rounded down
+constexpr int floorLog2 (int x) {
+    int l = 0;
+    while ((1 << (l + 1)) <= x) l++;
+    return l;
+}
+
+// Global history register as a circular buffer.  Pushing a bit only moves
+// the head, rather than shifting the whole register, and the bit pushed i
+// branches ago is h[i].  The buffer holds 2^LogSize bits, so any history
+// length shorter than that can be read from it; the default holds the same
+// GHIST_SIZE bits a std::bitset shifted left on each branch would.
+#define HIST_BUFFER_LOG		8	// 2^8 >= GHIST_SIZE
+
+template <int LogSize = HIST_BUFFER_LOG>
+struct HistoryBuffer {
+    static constexpr UINT32 HIST_BUFFER_SIZE = 1u << LogSize;
+
+    UINT8 bits[HIST_BUFFER_SIZE];	// one bit per byte, so reading one is a load
+    UINT32 head;					// where the newest bit is
+
+    void reset() {
+        memset(bits, 0, sizeof(bits));
+        head = 0;
+    }
+
+    void push(bool b) {
+        head = (head - 1) & (HIST_BUFFER_SIZE - 1);
+        bits[head] = b;
+    }
+
+    bool operator[](UINT32 i) const { return bits[(head + i) & (HIST_BUFFER_SIZE - 1)]; }
+
+    void checkpoint(predictor_state &s) {
+        s.array(bits, HIST_BUFFER_SIZE);
+        s.value(head);
+    }
+};
+
+// Small xorshift PRNG.  Each predictor has its own, so allocation choices
+// depend only on the seed and the trace, not on the time of day or on what
+// else is calling rand().
+struct RandomGen {
+    UINT32 state;
+
+    // xorshift never leaves 0, so don't start there
+    void seed(UINT32 s) { state = s ? s : 0x9e3779b9; }
+
+    UINT32 next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+// Lazy aging of the useful counters.  Every CLOCK_RESET_PERIOD branches the
+// predictors clear the high bit of every entry's useful counter, and the
+// next time the low bit.  Rather than sweeping the tables then, reset()
+// just counts the resets in epoch.  Each block of AGING_BLOCK entries
+// remembers in stamp the epoch it was last brought up to date in, and
+// sync() applies the resets it missed before any entry in it is used.  Two
+// resets in a row clear the counter, so all that matters is whether a
+// block missed none, one or more.  scrub() also brings a block up to date
+// now and then, often enough that each is visited between resets, so an
+// 8-bit stamp never wraps around.
+//
+// The stamps are kept per block rather than per entry so there are few
+// enough of them to stay in cache next to the much bigger tables.
+#define AGING_BLOCK_LOG		6
+#define AGING_BLOCK			(1 << AGING_BLOCK_LOG)
+
+template <class Entry, int NumTables>
+struct UsefulAging {
+    Entry **tables;				// the predictor's tables
+    UINT32 numEntries;			// entries per table
+    UINT32 numBlocks;			// blocks per table
+    UINT8 *stamp[NumTables];	// epoch each block was last synced in
+    UINT32 epoch;				// resets so far
+    UINT32 scrubTable, scrubBlock, scrubInterval, scrubClock;
+
+    UsefulAging() : tables(NULL), numEntries(0), numBlocks(0), epoch(0) {
+        for (int t = 0; t < NumTables; t++)
+            stamp[t] = NULL;
+    }
+
+    ~UsefulAging() {
+        for (int t = 0; t < NumTables; t++)
+            delete [] stamp[t];
+    }
+
+    void init(Entry **t, UINT32 n) {
+        tables = t;
+        numEntries = n;
+        numBlocks = (n + AGING_BLOCK - 1) / AGING_BLOCK;
+        for (int i = 0; i < NumTables; i++) {
+            delete [] stamp[i];
+            stamp[i] = new UINT8[numBlocks];
+            memset(stamp[i], 0, numBlocks);
+        }
+        epoch = 0;
+        scrubTable = scrubBlock = scrubClock = 0;
+
+        // visit every block at least once per reset period
+        scrubInterval = std::max(1u, (UINT32) (CLOCK_RESET_PERIOD / (NumTables * numBlocks)));
+    }
+
+    // Apply the resets block b of table t has missed
+    void syncBlock(int t, UINT32 b) {
+        UINT8 lag = (UINT8) epoch - stamp[t][b];
+        if (lag) {
+            Entry *e = &tables[t][b << AGING_BLOCK_LOG];
+            UINT32 n = std::min((UINT32) AGING_BLOCK, numEntries - (b << AGING_BLOCK_LOG));
+
+            // odd resets clear the low bit, even ones the high bit
+            if (lag > 1)
+                for (UINT32 i = 0; i < n; i++)
+                    e[i].setU(0);
+            else {
+                int keep = (epoch & 1) ? 2 : 1;
+                for (UINT32 i = 0; i < n; i++)
+                    e[i].setU(e[i].getU() & keep);
+            }
+            stamp[t][b] = epoch;
+        }
+    }
+
+    // Bring tables[t][i] up to date
+    void sync(int t, UINT32 i) { syncBlock(t, i >> AGING_BLOCK_LOG); }
+
+    // Age every entry
+    void reset() { epoch++; }
+
+    // The stamps and the scrubbing position; the tables are the predictor's
+    void checkpoint(predictor_state &s) {
+        for (int t = 0; t < NumTables; t++)
+            s.array(stamp[t], numBlocks);
+        s.value(epoch);
+        s.value(scrubTable);
+        s.value(scrubBlock);
+        s.value(scrubClock);
+    }
+
+    // Call once per clock tick; brings the next block up to date every
+    // scrubInterval ticks
+    void scrub() {
+        if (++scrubClock < scrubInterval)
+            return;
+        scrubClock = 0;
+        syncBlock(scrubTable, scrubBlock);
+        if (++scrubBlock == numBlocks) {
+            scrubBlock = 0;
+            if (++scrubTable == NumTables)
+                scrubTable = 0;
+        }
+    }
+};
 
 // Folded history compression; GHR(geometric length) -> Compressed(target)
 struct FoldedHist {
     UINT32 geomLength;		// Geometric history length
     UINT32 targetLength;	// Cropped size
     UINT32 compHist;		// Compressed history
+    UINT32 outPoint;		// Where the bit leaving the window is folded in
+
+    void init(UINT32 geom, UINT32 target) {
+        geomLength = geom;
+        targetLength = target;
+        compHist = 0;
+        outPoint = geom % target;
+    }
       
-    void updateCompHist(std::bitset<GHIST_SIZE> ghr) {
+    // Fold in the bit just pushed onto ghr and take out the one that
+    // just fell off the end of this history's window
+    template <class History>
+    void updateCompHist(const History &ghr) {
         int mask = (1 << targetLength) - 1;
-        int mask1 = ghr[geomLength] << (geomLength % targetLength);
+        int mask1 = ghr[geomLength] << outPoint;
         int mask2 = (1 << targetLength);
 		compHist  = (compHist << 1) + ghr[0];
 		compHist ^= ((compHist & mask2) >> targetLength);
@@ -32,4 +213,124 @@ struct FoldedHist {
     }    
 };
 
+// Global and path history for one or more predictor components.  Each
+// component subscribes, when it is constructed, to the folded histories
+// it needs and gets back a pointer to read each by; a folded history that
+// several components want is kept once, and update() shifts each branch
+// into all of them once.  A component used alone owns a provider and
+// updates it itself; the components of a composite predictor share one
+// that the composite updates after updating them.
+#define MAX_FOLDED_HISTORIES	64
+
+template <int LogSize = HIST_BUFFER_LOG>
+class HistoryProvider {
+public:
+    HistoryBuffer<LogSize> GHR;     // Global history register
+    int PHR;                        // 16bit path history register
+
+private:
+    FoldedHist folded[MAX_FOLDED_HISTORIES];
+    int numFolded;
+
+public:
+    HistoryProvider (void) : PHR(0), numFolded(0) { GHR.reset(); }
+
+    // The last geomLength bits of history folded into targetLength
+    const UINT32 *subscribe(UINT32 geomLength, UINT32 targetLength) {
+        for (int i = 0; i < numFolded; i++)
+            if (folded[i].geomLength == geomLength && folded[i].targetLength == targetLength)
+                return &folded[i].compHist;
+        if (numFolded == MAX_FOLDED_HISTORIES || geomLength >= HistoryBuffer<LogSize>::HIST_BUFFER_SIZE) {
+            fprintf (stderr, "history provider can't keep %u bits of history folded to %u\n", geomLength, targetLength);
+            exit (1);
+        }
+        folded[numFolded].init(geomLength, targetLength);
+        return &folded[numFolded++].compHist;
+    }
+
+    int numFoldedHistories(void) const { return numFolded; }
+
+    // The registers and folded histories; a provider restored from s has
+    // to have the same subscriptions as the one that saved it
+    void checkpoint(predictor_state &s) {
+        int n = numFolded;
+        GHR.checkpoint(s);
+        s.value(PHR);
+        s.value(n);
+        if (n != numFolded) {
+            s.ok = false;
+            return;
+        }
+        for (int i = 0; i < numFolded; i++)
+            s.value(folded[i].compHist);
+    }
+
+    // Shift in a history bit and the LSB of the branch address
+    void update(bool bit, UINT32 address) {
+        GHR.push(bit);
+        for (int i = 0; i < numFolded; i++)
+            folded[i].updateCompHist(GHR);
+        PHR = ((PHR << 1) | (address & 1)) & ((1 << 16) - 1);
+    }
+};
+
+// Which tables hold a matching tag: bit i of the result is set if
+// stored[i] == tag[i].  The tags are compared a vector at a time, eight
+// with AVX2 and four with SSE2, and any left over one at a time without a
+// branch, so the provider (lowest set bit) and alternate (next one) are
+// found with no data-dependent branch per table.
+template <int NumTables>
+inline UINT32 tagMatchMask(const UINT32 *stored, const UINT32 *tag) {
+    static_assert(NumTables <= 32, "one bit per table");
+    UINT32 mask = 0;
+    int i = 0;
+#ifdef __AVX2__
+    for (; i + 8 <= NumTables; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (stored + i)),
+                                        _mm256_loadu_si256((const __m256i *) (tag + i)));
+        mask |= (UINT32) _mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+    }
+#endif
+#ifdef __SSE2__
+    for (; i + 4 <= NumTables; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (stored + i)),
+                                     _mm_loadu_si128((const __m128i *) (tag + i)));
+        mask |= (UINT32) _mm_movemask_ps(_mm_castsi128_ps(eq)) << i;
+    }
+#endif
+    for (; i < NumTables; i++)
+        mask |= (UINT32) (stored[i] == tag[i]) << i;
+    return mask;
+}
+
+// Lowest table in a match mask, or none if it is empty
+inline int firstMatch(UINT32 mask, int none) {
+    return mask ? __builtin_ctz(mask) : none;
+}
+
+// Bit i set if the 16bit tag in way i of a set matches tag; for
+// set-associative tables that keep their tags apart from the rest of
+// their entries, so that a whole set is compared at once
+template <int Ways>
+inline UINT32 wayMatchMask(const uint16_t *tags, uint16_t tag) {
+    static_assert(Ways <= 32, "one bit per way");
+    UINT32 mask = 0;
+    int i = 0;
+#ifdef __SSE2__
+    __m128i t = _mm_set1_epi16((short) tag);
+    for (; i + 8 <= Ways; i += 8) {
+        __m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) (tags + i)), t);
+        mask |= (UINT32) (_mm_movemask_epi8(_mm_packs_epi16(eq, eq)) & 0xff) << i;
+    }
+    if (i + 4 <= Ways) {
+        __m128i eq = _mm_cmpeq_epi16(_mm_loadl_epi64((const __m128i *) (tags + i)), t);
+        mask |= (UINT32) (_mm_movemask_epi8(_mm_packs_epi16(eq, eq)) & 0xf) << i;
+        i += 4;
+    }
+#endif
+    for (; i < Ways; i++)
+        mask |= (UINT32) (tags[i] == tag) << i;
+    return mask;
+}
+
 #endif  // TOOLS_H
\ No newline at end of file
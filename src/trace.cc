@@ -9,9 +9,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "branch.h"
 #include "trace.h"
+#include "trace_cache.h"
+#include "bzip2_parallel.h"
+#include "trace_index.h"
 
 // A trace is a piece of information about a branch.  The external 
 // representation of a trace is 9 bytes:
@@ -31,8 +35,10 @@
 // where the branch jumped.
 //
 // The input file is usually compressed either with gzip or bzip2 and this
-// file contains code to support reading from these formats by piping the
-// output of the decompressors.  However, this file s does another kind of
+// file contains code to support reading from these formats by linking
+// libbz2 and zlib and decompressing straight into the read buffer (or, if
+// trace_pipe is set, by piping the output of the decompressors as the
+// original infrastructure did).  However, this file s does another kind of
 // decompression on the traces after they have been decompressed by gzip
 // or bzip2.  If the upper four bits of the first byte read are either
 // 0 or 8 then the byte indicates that the trace has been compressed
@@ -44,30 +50,80 @@
 
 // number of bytes to read at once from the decompressor
 
-#define BUFSIZE	10000
+#define BUFSIZE	65536
 
-// file pointer for the pipe from the decompressor
+// set to decompress through a pipe from ZCAT/BZCAT/CAT instead of in-process
 
-FILE *tracefp;
+bool trace_pipe = false;
 
-// buffer to read bytes into
+// if set, the directory holding decode-once trace caches
 
-unsigned char buf[BUFSIZE];
+const char *trace_cache_dir = NULL;
 
-// current position in buffer
-unsigned int bufpos;
+// number of threads to decompress bzip2 traces with
 
-// number of bytes read into buffer
+int trace_threads = 1;
 
-unsigned int bufsize;
+// read up to n decompressed bytes into p from a bzip2 file.  a file may be
+// several concatenated bzip2 streams (e.g. from pbzip2) so at the end of
+// a stream we reopen on whatever bytes are left over, like bzip2 -dc does.
 
-// true when end of file is reached
+int trace_reader::read_bzip2 (unsigned char *p, int n) {
+	int got = 0;
+	while (got < n && bzfp) {
+		int err;
+		got += BZ2_bzRead (&err, bzfp, p + got, n - got);
+		if (err == BZ_OK) continue;
+		if (err != BZ_STREAM_END) {
+			fprintf (stderr, "bzip2 error %d reading trace\n", err);
+			exit (1);
+		}
+		void *unused;
+		int nunused;
+		char rest[BZ_MAX_UNUSED];
+		BZ2_bzReadGetUnused (&err, bzfp, &unused, &nunused);
+		memcpy (rest, unused, nunused);
+		BZ2_bzReadClose (&err, bzfp);
+		bzfp = NULL;
+		if (nunused == 0) {
+			int ch = fgetc (tracefp);
+			if (ch == EOF) break;
+			rest[nunused++] = ch;
+		}
+		bzfp = BZ2_bzReadOpen (&err, tracefp, 0, 0, rest, nunused);
+		if (err != BZ_OK) {
+			fprintf (stderr, "bzip2 error %d reading trace\n", err);
+			exit (1);
+		}
+	}
+	return got;
+}
 
-bool end_of_file;
+// fill the buffer with up to BUFSIZE bytes from the input
+
+unsigned int trace_reader::fill_buf (void) {
+	int n;
+	switch (source) {
+	case SRC_BZIP2:
+		return read_bzip2 (buf, BUFSIZE);
+	case SRC_BZIP2_PARALLEL:
+		return bzpar->read (buf, BUFSIZE);
+	case SRC_GZIP:
+		n = gzread (gzfp, buf, BUFSIZE);
+		if (n < 0) {
+			int err;
+			fprintf (stderr, "gzip error reading trace: %s\n", gzerror (gzfp, &err));
+			exit (1);
+		}
+		return n;
+	default:
+		return fread (buf, 1, BUFSIZE, tracefp);
+	}
+}
 
 // read a single byte from the trace file
 
-unsigned char read_byte (void) {
+unsigned char trace_reader::read_byte (void) {
 
 	// if the buffer is empty...
 
@@ -75,8 +131,9 @@ unsigned char read_byte (void) {
 
 		// get a BUFSIZE-sized chunk of bytes from the input
 
+		stream_base += bufsize;
 		bufpos = 0;
-		bufsize = fread (buf, 1, BUFSIZE, tracefp);
+		bufsize = fill_buf ();
 
 		// nothing to read?  we must be done.
 
@@ -93,7 +150,7 @@ unsigned char read_byte (void) {
 
 // read an unsigned integer in little endian format from the trace file
 
-unsigned int read_uint (void) {
+unsigned int trace_reader::read_uint (void) {
 	unsigned int x0, x1, x2, x3;
 
 	x0 = read_byte ();
@@ -109,86 +166,38 @@ unsigned int read_uint (void) {
 // obviously this is a space win, but it is also a measurable performance 
 // win since there are fewer bytes to read.
 
-struct remember {
-	bool taken;
-	unsigned char code; 
-	unsigned int address, target;
-	unsigned int lru_time;
-
-	// constructor
-
-	remember (void) {
-		code = 0;
-		address = 0;
-		target = 0;
-		taken = 0;
-		lru_time = 0;
-	}
-
-	// return true if two remember structs are equivalent.  optionally
-	// ignore the target since it might have been correctly predicted
-	// by the return address stack
-
-	bool equal (remember *r, bool ignore_target) {
-		return
-		   r->code == code
-		&& r->taken == taken
-		&& r->address == address 
-		&& (ignore_target || r->target == target);
-	}
-};
-
 // a return address stack
-                                                                                
-#define RAS_SIZE        100
-                                                                                
-unsigned int ras[RAS_SIZE];
-int ras_top = RAS_SIZE;
 
 // (re)initialize the return address stack
-void init_ras (void) {
+void trace_reader::init_ras (void) {
 	ras_top = RAS_SIZE;
 }
 
 // push a target onto the return address stack
 
-void push_ras (unsigned int a) {
+void trace_reader::push_ras (unsigned int a) {
 	if (ras_top) ras[--ras_top] = a;
 }
 
 // pop a target from the return address stack
 
-unsigned int pop_ras (void) {
+unsigned int trace_reader::pop_ras (void) {
 	if (ras_top < RAS_SIZE) return ras[ras_top++];
 	return 0;
 }
 
-// parameters for the predictor table
-
-#define N_REMEMBER	(1<<16)
-#define ASSOC		8
-
-// the predictor table; a 64k-entry 8-way set associative memory.
+// the predictor table (rtab) is a 64k-entry 8-way set associative memory.
 // a hash table with probing would probably be more space-efficient
 // but I think this is a little faster (neither has good locality).
 // we can only remember up to 8 possible predictions per branch target
 // because we're squeezing set indices into a 3-bit code so having
 // a fixed set size is OK.  in practice, most branches need only 1 or 2
 // possible predictions, but some traces benefit from higher associativity.
-
-remember rtab[N_REMEMBER][ASSOC];
-
-// this int keeps time for the LRU algorithm
-
-static unsigned int now = 0; 
-
-// last trace seen
-
-static remember last_one; 
+// "now" keeps time for the LRU algorithm.
 
 // predict a trace
 
-remember *predict_remember (void) {
+remember *trace_reader::predict_remember (void) {
 	unsigned int index = last_one.target & (N_REMEMBER-1);
 	remember *r = &rtab[index][0];
 	return r;
@@ -196,7 +205,7 @@ remember *predict_remember (void) {
 
 // update the predictor
 
-void update_remember (remember & me, remember *r, bool correct, int index) {
+void trace_reader::update_remember (remember & me, remember *r, bool correct, int index) {
 	if (correct) {
 		r[index].lru_time = now++;
 	} else {
@@ -210,18 +219,80 @@ void update_remember (remember & me, remember *r, bool correct, int index) {
 	last_one = me;
 }
 
-// read a single trace from the file
+// forget everything the predictor table and return address stack have
+// learned so a new trace decodes the way the compressor encoded it
 
-trace *read_trace (void) {
-	static trace t;
-	bool ras_correct, ras_offby2, ras_offby3, correct;
+void trace_reader::init_remember (void) {
+	for (int i=0; i<N_REMEMBER; i++)
+		for (int j=0; j<ASSOC; j++)
+			rtab[i][j] = remember ();
+	now = 0;
+	last_one = remember ();
+	init_ras ();
+}
 
-	// read the next byte; it will either be a code, a set index for
-	// a correct prediction, or a prefix for patching a return address 
-	// prediction.
+// read a single trace from the mapped cache
+
+trace *trace_reader::read_cached_trace (void) {
+	if (cache_pos == cache_count) return NULL;
+	const trace_record & r = cache_records[cache_pos++];
+	branches++;
+	t.bi.address = r.address;
+	t.bi.opcode = r.opcode;
+	t.bi.br_flags = r.br_flags;
+	t.target = r.target;
+	t.taken = r.taken;
+	return & t;
+}
 
-	unsigned char c = read_byte ();
-	if (end_of_file) return NULL;
+// append a decoded trace to the cache being written
+
+void trace_reader::cache_trace (const trace & t) {
+	trace_record r;
+	r.address = t.bi.address;
+	r.target = t.target;
+	r.opcode = t.bi.opcode;
+	r.br_flags = t.bi.br_flags;
+	r.taken = t.taken;
+	r.pad = 0;
+	write_trace_cache (cache_out, r);
+}
+
+// byte sources for decode.  checked_bytes goes through read_byte, which
+// refills the buffer as needed.  buffered_bytes reads straight out of the
+// buffer with no checks, so it is only used when the buffer holds at least
+// MAX_TRACE_BYTES.
+
+struct trace_reader::checked_bytes {
+	trace_reader *r;
+
+	unsigned char byte (void) { return r->read_byte (); }
+	unsigned int uint (void) { return r->read_uint (); }
+};
+
+struct trace_reader::buffered_bytes {
+	const unsigned char *p;
+
+	unsigned char byte (void) { return *p++; }
+	unsigned int uint (void) {
+		unsigned int x = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+		p += 4;
+		return x;
+	}
+};
+
+// the most bytes one trace can take: a return address patch prefix, a code,
+// and an address and target
+
+#define MAX_TRACE_BYTES	10
+
+// decode a single trace into t.  c is the first byte; it will either be a
+// code, a set index for a correct prediction, or a prefix for patching a
+// return address prediction.  the rest of the bytes come from in.
+
+template <class B>
+inline void trace_reader::decode (unsigned char c, trace & t, B & in) {
+	bool ras_correct, ras_offby2, ras_offby3, correct;
 	remember r;
 
 	// predict the next trace
@@ -256,7 +327,7 @@ trace *read_trace (void) {
 		// read the next byte; it should be the set index for
 		// a correct return address prediction
 
-		c = read_byte ();
+		c = in.byte ();
 	}
 
 	// the byte is a correct prediction if it is less than 8;
@@ -330,11 +401,11 @@ trace *read_trace (void) {
 
 		// read the branch address
 
-		t.bi.address = read_uint ();
+		t.bi.address = in.uint ();
 
 		// read the branch target
 
-		t.target = read_uint ();
+		t.target = in.uint ();
 
 		// assume the branch is taken; fix later
 
@@ -410,26 +481,167 @@ trace *read_trace (void) {
 	// this should "never" happen
 	default: fprintf (stderr, "%d\n", c); fflush (stderr); assert (0);
 	}
+	if (cache_out) cache_trace (t);
+}
+
+// read a single trace from the file
+
+trace *trace_reader::next (void) {
+	if (source == SRC_CACHE) return read_cached_trace ();
+
+	unsigned char c = read_byte ();
+	if (end_of_file) return NULL;
+	checked_bytes in = { this };
+	decode (c, t, in);
+	branches++;
 	return & t;
 }
 
+// read up to max traces into out.  returns the number read; fewer than
+// max only at the end of the trace.
+
+size_t trace_reader::next (trace *out, size_t max) {
+	size_t n = 0;
+
+	if (source == SRC_CACHE) {
+		for (; n < max && cache_pos < cache_count; n++) {
+			const trace_record & r = cache_records[cache_pos++];
+			out[n].bi.address = r.address;
+			out[n].bi.opcode = r.opcode;
+			out[n].bi.br_flags = r.br_flags;
+			out[n].target = r.target;
+			out[n].taken = r.taken;
+		}
+		branches += n;
+		return n;
+	}
+	while (n < max) {
+
+		// decode straight out of the buffer while there is
+		// certainly room for another trace in it
+
+		buffered_bytes in = { buf + bufpos };
+		while (n < max && (unsigned int) (in.p - buf) + MAX_TRACE_BYTES <= bufsize) {
+			unsigned char c = in.byte ();
+			decode (c, out[n++], in);
+		}
+		bufpos = in.p - buf;
+
+		// near the end of the buffer; go a byte at a time so it
+		// can be refilled
+
+		if (n < max) {
+			unsigned char c = read_byte ();
+			if (end_of_file) break;
+			checked_bytes cin = { this };
+			decode (c, out[n++], cin);
+		}
+	}
+	branches += n;
+	return n;
+}
+
+// the decoder state is too big to put on a thread's stack, so it lives
+// on the heap
+
+trace_reader::trace_reader (void) :
+	pipe(trace_pipe), cache_dir(trace_cache_dir), threads(trace_threads),
+	seekable(false), source(SRC_NONE), tracefp(NULL), bzfp(NULL), gzfp(NULL), bzpar(NULL),
+	end_of_file(false), 
+	cache_records(NULL), cache_out(NULL) {
+	buf = new unsigned char[BUFSIZE];
+	rtab = new remember[N_REMEMBER][ASSOC];
+}
+
+trace_reader::~trace_reader (void) {
+	close ();
+	delete [] buf;
+	delete [] rtab;
+	delete bzpar;
+}
+
 // open the trace file for reading
 
 #define GZIP_MAGIC     "\037\213"
 #define BZIP2_MAGIC	"BZ"
 
-void init_trace (char *fname) {
-	char *dc;
+void trace_reader::open (const char *fname) {
+	const char *dc;
 	char s[2] = { 0, 0 };
 	char cmd[1000];
 
+	close ();
+	branches = 0;
+	stream_base = 0;
+
+	// if there is an up-to-date cache for this trace, just map it;
+	// otherwise decode as usual and build one along the way
+
+	if (cache_dir) {
+		char cname[1000];
+		trace_cache_name (cname, sizeof (cname), cache_dir, fname);
+		cache_records = map_trace_cache (cname, fname, &cache_count);
+		if (cache_records) {
+			cache_pos = 0;
+			source = SRC_CACHE;
+			return;
+		}
+		cache_out = create_trace_cache (cname, fname);
+	}
+
 	// figure out the compression method from the magic number
 
 	FILE *f = fopen (fname, "r");
 	if (!f) {
 		perror (fname);
+		exit (1);
 	}
 	fread (s, 1, 2, f);
+	bufpos = 0;
+	bufsize = 0;
+	end_of_file = false;
+	init_remember ();
+
+	if (!pipe) {
+		int err;
+		if (strncmp (s, BZIP2_MAGIC, 2) == 0 && (threads > 1 || seekable)) {
+
+			// decompress blocks of the file on a pool of threads
+
+			fclose (f);
+			if (!bzpar) bzpar = new bzip2_parallel;
+			if (!bzpar->open (fname, threads > 1 ? threads : 1)) {
+				fprintf (stderr, "%s: can't open bzip2 stream\n", fname);
+				exit (1);
+			}
+			source = SRC_BZIP2_PARALLEL;
+		} else if (strncmp (s, BZIP2_MAGIC, 2) == 0) {
+
+			// libbz2 reads the compressed file through our FILE
+
+			rewind (f);
+			tracefp = f;
+			bzfp = BZ2_bzReadOpen (&err, tracefp, 0, 0, NULL, 0);
+			if (err != BZ_OK) {
+				fprintf (stderr, "%s: can't open bzip2 stream\n", fname);
+				exit (1);
+			}
+			source = SRC_BZIP2;
+		} else {
+
+			// zlib passes through files that aren't gzipped
+
+			fclose (f);
+			gzfp = gzopen (fname, "rb");
+			if (!gzfp) {
+				perror (fname);
+				exit (1);
+			}
+			gzbuffer (gzfp, BUFSIZE);
+			source = SRC_GZIP;
+		}
+		return;
+	}
 	fclose (f);
 	if (strncmp (s, GZIP_MAGIC, 2) == 0) 
 		dc = ZCAT;
@@ -449,13 +661,263 @@ void init_trace (char *fname) {
 		perror (fname);
 		exit (1);
 	}
+	source = SRC_PIPE;
+}
+
+// close the trace file
+
+void trace_reader::close (void) {
+	int err;
+	if (cache_out) {
+		finish_trace_cache (cache_out, end_of_file);
+		cache_out = NULL;
+	}
+	switch (source) {
+	case SRC_CACHE:
+		unmap_trace_cache (cache_records, cache_count);
+		break;
+	case SRC_BZIP2:
+		if (bzfp) BZ2_bzReadClose (&err, bzfp);
+		bzfp = NULL;
+		fclose (tracefp);
+		break;
+	case SRC_BZIP2_PARALLEL:
+		bzpar->close ();
+		break;
+	case SRC_GZIP:
+		gzclose (gzfp);
+		break;
+	case SRC_PIPE:
+		pclose (tracefp);
+		break;
+	case SRC_NONE:
+		break;
+	}
+	source = SRC_NONE;
+}
+
+// append and extract little-endian integers for saving the decoder state
+
+static void put_uint (std::vector<unsigned char> & v, unsigned int x) {
+	for (int i=0; i<4; i++) v.push_back (x >> (8 * i));
+}
+
+static unsigned int get_uint (const unsigned char *& p) {
+	unsigned int x = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+	p += 4;
+	return x;
+}
+
+static void put_remember (std::vector<unsigned char> & v, const remember & r) {
+	v.push_back (r.taken);
+	v.push_back (r.code);
+	put_uint (v, r.address);
+	put_uint (v, r.target);
+	put_uint (v, r.lru_time);
+}
+
+static void get_remember (const unsigned char *& p, remember & r) {
+	r.taken = *p++;
+	r.code = *p++;
+	r.address = get_uint (p);
+	r.target = get_uint (p);
+	r.lru_time = get_uint (p);
+}
+
+// the bytes one rtab entry takes in a saved state: its set, way, and
+// contents
+
+#define SAVED_REMEMBER_BYTES	(4 + 1 + 14)
+
+// whether v is laid out as save lays out a decoder state: now, last_one,
+// ras_top and the RAS entries in use, then whole rtab entries.  the state
+// comes from an index file, so restore checks it before trusting it.
+
+static bool decoder_state_ok (const std::vector<unsigned char> & v) {
+	size_t head = 4 + 14 + 4;
+	if (v.size () < head) return false;
+	const unsigned char *p = v.data () + head - 4;
+	unsigned int top = get_uint (p);
+	if (top > RAS_SIZE) return false;
+	head += 4 * (RAS_SIZE - top);
+	return v.size () >= head && (v.size () - head) % SAVED_REMEMBER_BYTES == 0;
+}
+
+bool trace_reader::save (trace_state & s) {
+	s.branch = branches;
+	s.stream_pos = stream_base + bufpos;
+	s.block_bit = 0;
+	s.block_skip = 0;
+	switch (source) {
+	case SRC_BZIP2_PARALLEL:
+		if (!bzpar->locate (s.stream_pos, &s.block_bit, &s.block_skip)) return false;
+		break;
+	case SRC_GZIP:
+		break;
+	default:
+		return false;
+	}
+
+	// most of rtab is never touched, so only save the entries that
+	// have been.  every real entry has a nonzero code.
+
+	std::vector<unsigned char> & v = s.decoder;
+	v.clear ();
+	put_uint (v, now);
+	put_remember (v, last_one);
+	put_uint (v, ras_top);
+	for (int i=ras_top; i<RAS_SIZE; i++) put_uint (v, ras[i]);
+	for (int i=0; i<N_REMEMBER; i++) {
+		for (int j=0; j<ASSOC; j++) {
+			if (rtab[i][j].code) {
+				put_uint (v, i);
+				v.push_back (j);
+				put_remember (v, rtab[i][j]);
+			}
+		}
+	}
+	return true;
+}
+
+bool trace_reader::restore (const char *fname, const trace_state & s) {
+	open (fname);
+	branches = s.branch;
+	if (source == SRC_CACHE) {
+		if (s.branch > cache_count) {
+			fprintf (stderr, "%s: trace state is past the end of the cache\n", fname);
+			return false;
+		}
+		cache_pos = s.branch;
+		return true;
+	}
+	if (!decoder_state_ok (s.decoder)) {
+		fprintf (stderr, "%s: bad decoder state in trace index\n", fname);
+		return false;
+	}
+
+	// we aren't decoding from the start, so don't leave a cache behind
+
+	if (cache_out) {
+		finish_trace_cache (cache_out, false);
+		cache_out = NULL;
+	}
+
+	int err;
+	switch (source) {
+	case SRC_BZIP2:
+		BZ2_bzReadClose (&err, bzfp);
+		bzfp = NULL;
+		fclose (tracefp);
+		if (!bzpar) bzpar = new bzip2_parallel;
+		// fall through
+	case SRC_BZIP2_PARALLEL:
+		source = SRC_BZIP2_PARALLEL;
+		bzpar->close ();
+		if (!bzpar->open (fname, threads > 1 ? threads : 1, s.block_bit, s.stream_pos - s.block_skip)) {
+			fprintf (stderr, "%s: no bzip2 block at bit %llu\n", fname, s.block_bit);
+			return false;
+		}
+		for (unsigned long long left = s.block_skip; left; ) {
+			size_t n = bzpar->read (buf, left < BUFSIZE ? left : BUFSIZE);
+			if (!n) {
+				fprintf (stderr, "%s: trace state is past the end of the trace\n", fname);
+				return false;
+			}
+			left -= n;
+		}
+		break;
+	case SRC_GZIP:
+		if (gzseek (gzfp, s.stream_pos, SEEK_SET) < 0) {
+			fprintf (stderr, "%s: can't seek to %llu\n", fname, s.stream_pos);
+			return false;
+		}
+		break;
+	default:
+		fprintf (stderr, "%s: can't start a piped trace in the middle\n", fname);
+		return false;
+	}
 	bufpos = 0;
 	bufsize = 0;
-	end_of_file = false;
+	stream_base = s.stream_pos;
+
+	// open cleared the decoder tables; put back the saved entries
+
+	const unsigned char *p = s.decoder.data (), *end = p + s.decoder.size ();
+	now = get_uint (p);
+	get_remember (p, last_one);
+	ras_top = get_uint (p);
+	for (int i=ras_top; i<RAS_SIZE; i++) ras[i] = get_uint (p);
+	while (p + SAVED_REMEMBER_BYTES <= end) {
+		unsigned int i = get_uint (p);
+		unsigned int j = *p++;
+		get_remember (p, rtab[i & (N_REMEMBER-1)][j % ASSOC]);
+	}
+	return true;
 }
 
-// close the trace file
+unsigned long long trace_reader::skip (unsigned long long n) {
+	if (source == SRC_CACHE) {
+		if (n > cache_count - cache_pos) n = cache_count - cache_pos;
+		cache_pos += n;
+		branches += n;
+		return n;
+	}
+	trace block[256];
+	unsigned long long done = 0;
+	while (done < n) {
+		size_t got = next (block, n - done < 256 ? n - done : 256);
+		if (!got) break;
+		done += got;
+	}
+	return done;
+}
+
+void trace_reader::open_at (const char *fname, unsigned long long first) {
+	std::vector<trace_state> index;
+
+	open (fname);
+	if (first == 0) return;
+
+	// start from the last checkpoint at or before first, if any, and
+	// decode the rest of the way
+
+	if (source != SRC_CACHE && load_trace_index (fname, index)) {
+		const trace_state *best = NULL;
+		for (size_t i=0; i<index.size (); i++)
+			if (index[i].branch <= first) best = &index[i];
+		if (best && !restore (fname, *best)) {
+			fprintf (stderr, "%s: ignoring the trace index\n", fname);
+			open (fname);
+		}
+	}
+	skip (first - branches);
+}
+
+// the original interface reads one trace at a time through a single
+// reader
+
+static trace_reader *the_reader;
+
+void init_trace_at (char *fname, unsigned long long first) {
+	if (!the_reader) the_reader = new trace_reader;
+	the_reader->pipe = trace_pipe;
+	the_reader->cache_dir = trace_cache_dir;
+	the_reader->threads = trace_threads;
+	the_reader->open_at (fname, first);
+}
+
+void init_trace (char *fname) {
+	init_trace_at (fname, 0);
+}
+
+trace *read_trace (void) {
+	return the_reader->next ();
+}
+
+size_t read_traces (trace *out, size_t max) {
+	return the_reader->next (out, max);
+}
 
 void end_trace (void) {
-	fclose (tracefp);
+	the_reader->close ();
 }
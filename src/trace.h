@@ -1,9 +1,19 @@
 // trace.h
 // This file declares functions and a struct for reading trace files.
 
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <bzlib.h>
+#include <zlib.h>
+#include <vector>
+
 // these #define the Unix commands for decompressing gzip, bzip2, and
-// plain files.  If they are somewhere else on your system, change these
-// definitions.
+// plain files.  They are only used when trace_pipe is set; normally the
+// traces are decompressed in-process with libbz2 and zlib.  If they are
+// somewhere else on your system, change these definitions.
 
 #define ZCAT            "/bin/gzip -dc"
 #define BZCAT           "/usr/bin/bzip2 -dc"
@@ -15,6 +25,241 @@ struct trace {
 	branch_info bi;
 };
 
+// set before init_trace to decompress through a pipe from the commands
+// above instead of in-process
+
+extern bool trace_pipe;
+
+// set before init_trace to the name of a directory to keep decode-once
+// caches of the traces in (see trace_cache.h)
+
+extern const char *trace_cache_dir;
+
+// set before init_trace to decompress bzip2 traces with this many threads
+// (see bzip2_parallel.h)
+
+extern int trace_threads;
+
+// read traces one at a time from a single trace file.  these functions
+// use one trace_reader shared by the whole process.
+
 void init_trace (char *);
 trace *read_trace (void);
 void end_trace (void);
+
+// like init_trace, but start at branch number first (counting from 0),
+// using the trace's index if it has one (see trace_index.h)
+
+void init_trace_at (char *, unsigned long long first);
+
+// read up to max traces into out.  returns how many were read; 0 at the
+// end of the trace.  this is much faster than calling read_trace for each
+// branch.
+
+size_t read_traces (trace *out, size_t max);
+
+// one entry in the trace decompressor's predictor table; see trace.cc
+
+struct remember {
+	bool taken;
+	unsigned char code; 
+	unsigned int address, target;
+	unsigned int lru_time;
+
+	// constructor
+
+	remember (void) {
+		code = 0;
+		address = 0;
+		target = 0;
+		taken = 0;
+		lru_time = 0;
+	}
+
+	// return true if two remember structs are equivalent.  optionally
+	// ignore the target since it might have been correctly predicted
+	// by the return address stack
+
+	bool equal (remember *r, bool ignore_target) {
+		return
+		   r->code == code
+		&& r->taken == taken
+		&& r->address == address 
+		&& (ignore_target || r->target == target);
+	}
+};
+
+// parameters for the trace decompressor's predictor table and return
+// address stack
+
+#define N_REMEMBER	(1<<16)
+#define ASSOC		8
+#define RAS_SIZE        100
+
+struct trace_record;
+struct trace_cache_writer;
+class bzip2_parallel;
+
+// enough of a trace_reader's state to start decoding part of the way
+// through a trace; see trace_index.h
+
+struct trace_state {
+	unsigned long long 
+		branch,		// number of branches before this point
+		stream_pos,	// decompressed bytes before this point
+		block_bit,	// bzip2: start of the block holding stream_pos
+		block_skip;	// bzip2: how far into that block stream_pos is
+
+	// the remember table, LRU time, last trace and RAS
+
+	std::vector<unsigned char> decoder;
+};
+
+// a trace_reader holds everything needed to decode one trace file, so 
+// any number of them can be open at once, e.g. one per thread.  a reader 
+// can be reused for another trace after close.  each one allocates about
+// 8MB for the decompressor's predictor table.
+
+class trace_reader {
+public:
+	// options; these start out as trace_pipe, trace_cache_dir and
+	// trace_threads and can be changed before open
+
+	bool pipe;
+	const char *cache_dir;
+	int threads;
+
+	// set before open if save will be used.  this makes bzip2 traces
+	// go through bzip2_parallel even with one thread, so a position
+	// in the decompressed data can be tied to a block.
+
+	bool seekable;
+
+	trace_reader (void);
+	~trace_reader (void);
+
+	// open a trace file for reading; exits on error like init_trace
+
+	void open (const char *fname);
+
+	// decode the next branch.  returns NULL at the end of the trace.
+	// the trace is owned by the reader and is overwritten by the next
+	// call.
+
+	trace *next (void);
+
+	// decode up to max branches into out and return how many were
+	// decoded; fewer than max only at the end of the trace
+
+	size_t next (trace *out, size_t max);
+
+	// close the trace file
+
+	void close (void);
+
+	// open a trace file and skip to branch number first, starting from
+	// the last checkpoint before it in the trace's index if there is
+	// one
+
+	void open_at (const char *fname, unsigned long long first);
+
+	// the number of branches next has returned since the start of the
+	// trace
+
+	unsigned long long position (void) const { return branches; }
+
+	// save the state at the current position.  returns false if the
+	// trace can't be restarted from the middle (a pipe, a cache, or
+	// bzip2 without seekable).
+
+	bool save (trace_state &);
+
+	// open a trace file and go to a state saved by save.  returns false,
+	// saying why, if the state doesn't fit the trace; the reader then has
+	// to be opened again.
+
+	bool restore (const char *fname, const trace_state &);
+
+	// skip up to n branches; returns how many were skipped
+
+	unsigned long long skip (unsigned long long n);
+
+private:
+	// where the bytes come from
+
+	enum source_kind {
+		SRC_NONE,	// nothing open
+		SRC_PIPE,	// popen'd decompressor command
+		SRC_BZIP2,	// libbz2 reading from an open file
+		SRC_BZIP2_PARALLEL,	// libbz2 on a pool of threads
+		SRC_GZIP,	// zlib; also reads uncompressed files transparently
+		SRC_CACHE	// mmap'd decode-once cache; see trace_cache.h
+	} source;
+
+	// file pointer for the pipe from the decompressor, or the
+	// compressed file itself for libbz2
+
+	FILE *tracefp;
+
+	// libbz2 and zlib handles
+
+	BZFILE *bzfp;
+	gzFile gzfp;
+	bzip2_parallel *bzpar;
+
+	// buffer to read decompressed bytes into, current position in it,
+	// and number of bytes in it
+
+	unsigned char *buf;
+	unsigned int bufpos, bufsize;
+
+	// true when end of file is reached
+
+	bool end_of_file;
+
+	// branches returned so far, and the offset in the decompressed data
+	// of the start of buf
+
+	unsigned long long branches, stream_base;
+
+	// the mapped cache we are reading from, or the one we are writing
+
+	const trace_record *cache_records;
+	unsigned long long cache_count, cache_pos;
+	trace_cache_writer *cache_out;
+
+	// the decompressor's predictor table, the time for its LRU
+	// replacement, and the last trace seen
+
+	remember (*rtab)[ASSOC];
+	unsigned int now;
+	remember last_one;
+
+	// the decompressor's return address stack
+
+	unsigned int ras[RAS_SIZE];
+	int ras_top;
+
+	// the trace returned by next
+
+	trace t;
+
+	int read_bzip2 (unsigned char *, int);
+	unsigned int fill_buf (void);
+	unsigned char read_byte (void);
+	unsigned int read_uint (void);
+	void init_ras (void);
+	void push_ras (unsigned int);
+	unsigned int pop_ras (void);
+	void init_remember (void);
+	remember *predict_remember (void);
+	void update_remember (remember &, remember *, bool, int);
+	trace *read_cached_trace (void);
+	void cache_trace (const trace &);
+
+	struct checked_bytes;
+	struct buffered_bytes;
+	template <class B> void decode (unsigned char, trace &, B &);
+};
+
+#endif // TRACE_H
@@ -0,0 +1,137 @@
+// trace_cache.cc
+// This file contains code for building and mapping decode-once trace cache
+// files.  See trace_cache.h for the format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <atomic>
+
+#include "trace_cache.h"
+
+bool trace_file_checksum (const char *fname, unsigned long long *size, unsigned int *crc) {
+	FILE *f = fopen (fname, "rb");
+	if (!f) return false;
+	unsigned char b[65536];
+	size_t n;
+	uLong c = crc32 (0, Z_NULL, 0);
+	*size = 0;
+	while ((n = fread (b, 1, sizeof (b), f)) > 0) {
+		c = crc32 (c, b, n);
+		*size += n;
+	}
+	fclose (f);
+	*crc = c;
+	return true;
+}
+
+void trace_file_derived_name (char *out, size_t n, const char *dir, const char *fname, const char *suffix) {
+	const char *base = strrchr (fname, '/');
+	base = base ? base + 1 : fname;
+	char *path = realpath (fname, NULL);
+	const char *p = path ? path : fname;
+	unsigned int crc = crc32 (crc32 (0, Z_NULL, 0), (const Bytef *) p, strlen (p));
+	free (path);
+	snprintf (out, n, "%s/%s.%08x%s", dir, base, crc, suffix);
+}
+
+void temporary_file_name (char *out, size_t n, const char *name) {
+	static std::atomic<unsigned int> sequence (0);
+	snprintf (out, n, "%s.%d.%u", name, (int) getpid (), sequence++);
+}
+
+void trace_cache_name (char *out, size_t n, const char *dir, const char *fname) {
+	trace_file_derived_name (out, n, dir, fname, ".tcache");
+}
+
+// fill in a header for the trace file source
+
+static bool make_header (trace_cache_header *h, const char *source) {
+	memset (h, 0, sizeof (*h));
+	memcpy (h->magic, TRACE_CACHE_MAGIC, sizeof (h->magic));
+	h->version = TRACE_CACHE_VERSION;
+	h->record_size = sizeof (trace_record);
+	return trace_file_checksum (source, &h->source_size, &h->source_crc);
+}
+
+const trace_record *map_trace_cache (const char *cache, const char *source, unsigned long long *count) {
+	int fd = open (cache, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	struct stat st;
+	trace_cache_header want, h;
+	if (fstat (fd, &st) < 0
+	 || read (fd, &h, sizeof (h)) != sizeof (h)
+	 || !make_header (&want, source)) {
+		close (fd);
+		return NULL;
+	}
+
+	// everything but the count has to match, and the file has to be
+	// long enough to hold the records the header promises
+
+	want.count = h.count;
+	if (memcmp (&want, &h, sizeof (h)) != 0
+	 || (unsigned long long) st.st_size != sizeof (h) + h.count * sizeof (trace_record)) {
+		fprintf (stderr, "%s: stale trace cache; rebuilding\n", cache);
+		close (fd);
+		return NULL;
+	}
+
+	void *p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (p == MAP_FAILED) return NULL;
+	madvise (p, st.st_size, MADV_SEQUENTIAL);
+	*count = h.count;
+	return (const trace_record *) ((char *) p + sizeof (h));
+}
+
+void unmap_trace_cache (const trace_record *r, unsigned long long count) {
+	munmap ((char *) r - sizeof (trace_cache_header), 
+		sizeof (trace_cache_header) + count * sizeof (trace_record));
+}
+
+struct trace_cache_writer {
+	FILE *f;
+	trace_cache_header h;
+	char name[1000], tmpname[1000];
+};
+
+trace_cache_writer *create_trace_cache (const char *cache, const char *source) {
+	trace_cache_writer *w = new trace_cache_writer;
+	snprintf (w->name, sizeof (w->name), "%s", cache);
+	temporary_file_name (w->tmpname, sizeof (w->tmpname), cache);
+	if (!make_header (&w->h, source) || !(w->f = fopen (w->tmpname, "wb"))) {
+		perror (cache);
+		delete w;
+		return NULL;
+	}
+	setvbuf (w->f, NULL, _IOFBF, 1<<20);
+
+	// the count is filled in when we're done
+
+	fwrite (&w->h, sizeof (w->h), 1, w->f);
+	return w;
+}
+
+void write_trace_cache (trace_cache_writer *w, const trace_record &r) {
+	fwrite (&r, sizeof (r), 1, w->f);
+	w->h.count++;
+}
+
+void finish_trace_cache (trace_cache_writer *w, bool complete) {
+	if (complete) {
+		rewind (w->f);
+		fwrite (&w->h, sizeof (w->h), 1, w->f);
+	}
+	if (fclose (w->f) != 0 || !complete || rename (w->tmpname, w->name) != 0) {
+		if (complete) perror (w->name);
+		unlink (w->tmpname);
+	}
+	delete w;
+}
@@ -0,0 +1,77 @@
+// trace_cache.h
+// This file declares the decode-once trace cache.  A cache file holds a
+// trace that has already been through bzip2/gzip and the remember/RAS
+// decompression in trace.cc, as a flat array of fixed-width records that
+// later runs mmap and walk without any parsing.
+//
+// The header records the size and CRC-32 of the trace file the cache was
+// built from, so a cache left over from a different or regenerated trace
+// is rejected and rebuilt.
+
+#ifndef TRACE_CACHE_H
+#define TRACE_CACHE_H
+
+#include <stddef.h>
+
+#define TRACE_CACHE_MAGIC	"CBPTCACH"
+#define TRACE_CACHE_VERSION	1
+
+// one branch; 12 bytes
+
+struct trace_record {
+	unsigned int	address,	// branch address
+			target;		// branch target
+	unsigned char	opcode,		// opcode for conditional branch
+			br_flags,	// OR of some BR_ flags
+			taken,		// 1 if the branch was taken
+			pad;
+};
+
+struct trace_cache_header {
+	char		magic[8];	// TRACE_CACHE_MAGIC
+	unsigned int	version,	// TRACE_CACHE_VERSION
+			record_size;	// sizeof (trace_record)
+	unsigned long long source_size;	// size of the trace file in bytes
+	unsigned int	source_crc,	// CRC-32 of the trace file
+			pad;
+	unsigned long long count;	// number of records that follow
+};
+
+// compute the size and CRC-32 of a file; false if it can't be read
+
+bool trace_file_checksum (const char *fname, unsigned long long *size, unsigned int *crc);
+
+// make the name of a file in dir that holds something built from trace
+// file fname: its base name, the CRC-32 of its full path, so traces with
+// the same name in different directories don't share one, and suffix
+
+void trace_file_derived_name (char *out, size_t n, const char *dir, const char *fname, const char *suffix);
+
+// make the name of a temporary file to write and then rename to name.  it
+// is different in each process and each call, so threads writing the same
+// file at once don't write over each other.
+
+void temporary_file_name (char *out, size_t n, const char *name);
+
+// make the name of the cache file in dir for trace file fname
+
+void trace_cache_name (char *out, size_t n, const char *dir, const char *fname);
+
+// map a cache file built from the trace file source.  returns NULL if
+// there is no cache or it is stale; otherwise returns the records and
+// sets *count.
+
+const trace_record *map_trace_cache (const char *cache, const char *source, unsigned long long *count);
+void unmap_trace_cache (const trace_record *, unsigned long long count);
+
+// write a cache file; records go to a temporary file that is renamed into
+// place by finish_trace_cache once the whole trace has been decoded, so a
+// partial decode never leaves a cache behind.
+
+struct trace_cache_writer;
+
+trace_cache_writer *create_trace_cache (const char *cache, const char *source);
+void write_trace_cache (trace_cache_writer *, const trace_record &);
+void finish_trace_cache (trace_cache_writer *, bool complete);
+
+#endif // TRACE_CACHE_H
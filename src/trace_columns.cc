@@ -0,0 +1,142 @@
+// trace_columns.cc
+// This file contains code for building and mapping columnar trace files.
+// See trace_columns.h for the format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "branch.h"
+#include "trace.h"
+#include "trace_cache.h"
+#include "trace_columns.h"
+
+// round up to the next 64 byte boundary
+
+static unsigned long long align64 (unsigned long long x) {
+	return (x + 63) & ~63ULL;
+}
+
+static void column_file_name (char *out, size_t n, const char *dir, const char *fname) {
+	trace_file_derived_name (out, n, dir, fname, ".tcol");
+}
+
+// lay out the header for count branches from the trace file source
+
+static bool make_header (trace_columns_header *h, const char *source, unsigned long long count) {
+	memset (h, 0, sizeof (*h));
+	memcpy (h->magic, TRACE_COLUMNS_MAGIC, sizeof (h->magic));
+	h->version = TRACE_COLUMNS_VERSION;
+	h->count = count;
+	h->address_off = align64 (sizeof (*h));
+	h->target_off = align64 (h->address_off + count * 4);
+	h->code_off = align64 (h->target_off + count * 4);
+	h->taken_off = align64 (h->code_off + count);
+	return trace_file_checksum (source, &h->source_size, &h->source_crc);
+}
+
+static unsigned long long file_size (const trace_columns_header & h) {
+	return h.taken_off + (h.count + 63) / 64 * 8;
+}
+
+// write one column at its offset, padding up to it with zeros
+
+static bool write_column (FILE *f, unsigned long long off, const void *p, size_t n) {
+	static const char zeros[64] = { 0 };
+	long pos = ftell (f);
+	if (pos < 0 || (unsigned long long) pos > off) return false;
+	return fwrite (zeros, 1, off - pos, f) == off - pos 
+		&& fwrite (p, 1, n, f) == n;
+}
+
+// decode the trace and write its column file
+
+static bool build_columns (const char *cname, const char *fname) {
+	std::vector<unsigned int> address, target;
+	std::vector<unsigned char> code;
+	std::vector<unsigned long long> taken;
+	trace *t;
+
+	trace_reader reader;
+	reader.open (fname);
+	while ((t = reader.next ())) {
+		unsigned long long i = code.size ();
+		if ((i & 63) == 0) taken.push_back (0);
+		address.push_back (t->bi.address);
+		target.push_back (t->target);
+		code.push_back (trace_code (t->bi.br_flags, t->bi.opcode));
+		if (t->taken) taken.back () |= 1ULL << (i & 63);
+	}
+	reader.close ();
+
+	trace_columns_header h;
+	if (!make_header (&h, fname, code.size ())) return false;
+
+	char tmpname[1100];
+	temporary_file_name (tmpname, sizeof (tmpname), cname);
+	FILE *f = fopen (tmpname, "wb");
+	if (!f) {
+		perror (tmpname);
+		return false;
+	}
+	bool ok = fwrite (&h, sizeof (h), 1, f) == 1
+		&& write_column (f, h.address_off, address.data (), address.size () * 4)
+		&& write_column (f, h.target_off, target.data (), target.size () * 4)
+		&& write_column (f, h.code_off, code.data (), code.size ())
+		&& write_column (f, h.taken_off, taken.data (), taken.size () * 8);
+	if (fclose (f) != 0) ok = false;
+	if (!ok || rename (tmpname, cname) != 0) {
+		perror (cname);
+		unlink (tmpname);
+		return false;
+	}
+	return true;
+}
+
+// map a column file; false if it is missing or stale
+
+static bool map_columns (trace_columns *c, const char *cname, const char *fname) {
+	int fd = open (cname, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	trace_columns_header want, h;
+	if (fstat (fd, &st) < 0
+	 || read (fd, &h, sizeof (h)) != sizeof (h)
+	 || !make_header (&want, fname, h.count)
+	 || memcmp (&want, &h, sizeof (h)) != 0
+	 || (unsigned long long) st.st_size != file_size (h)) {
+		close (fd);
+		return false;
+	}
+	void *p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (p == MAP_FAILED) return false;
+
+	char *base = (char *) p;
+	c->count = h.count;
+	c->address = trace_span<unsigned int> ((unsigned int *) (base + h.address_off), h.count);
+	c->target = trace_span<unsigned int> ((unsigned int *) (base + h.target_off), h.count);
+	c->code = trace_span<unsigned char> ((unsigned char *) (base + h.code_off), h.count);
+	c->taken = trace_span<unsigned long long> ((unsigned long long *) (base + h.taken_off), (h.count + 63) / 64);
+	c->map = p;
+	c->map_size = st.st_size;
+	return true;
+}
+
+bool open_trace_columns (trace_columns *c, const char *dir, const char *fname) {
+	char cname[1000];
+	column_file_name (cname, sizeof (cname), dir, fname);
+	if (map_columns (c, cname, fname)) return true;
+	return build_columns (cname, fname) && map_columns (c, cname, fname);
+}
+
+void close_trace_columns (trace_columns *c) {
+	munmap (c->map, c->map_size);
+	c->map = NULL;
+}
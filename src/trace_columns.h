@@ -0,0 +1,84 @@
+// trace_columns.h
+// This file declares the columnar (struct-of-arrays) trace format.  A
+// column file holds a decoded trace as separate arrays:
+//
+// - address: 4 byte branch addresses
+// - target:  4 byte branch targets
+// - code:    1 byte per branch; BR_ flags in the upper 4 bits and the
+//            conditional branch opcode in the lower 4 bits
+// - taken:   a bitmap, bit i%64 of word i/64 is set if branch i was taken
+//
+// so a consumer that only looks at conditional branch outcomes touches
+// about 5 bytes per branch instead of a whole trace struct.  The file is
+// laid out so the columns can be used straight out of an mmap; each one
+// starts on a 64 byte boundary.  Like the record cache in trace_cache.h,
+// the header records the size and CRC-32 of the trace it was built from.
+
+#ifndef TRACE_COLUMNS_H
+#define TRACE_COLUMNS_H
+
+#define TRACE_COLUMNS_MAGIC	"CBPTCOLS"
+#define TRACE_COLUMNS_VERSION	1
+
+// a read-only view of n contiguous Ts
+
+template <class T>
+struct trace_span {
+	const T *ptr;
+	size_t n;
+
+	trace_span (void) : ptr(NULL), n(0) {}
+	trace_span (const T *p, size_t s) : ptr(p), n(s) {}
+
+	const T *data (void) const { return ptr; }
+	size_t size (void) const { return n; }
+	const T *begin (void) const { return ptr; }
+	const T *end (void) const { return ptr + n; }
+	const T & operator[] (size_t i) const { return ptr[i]; }
+};
+
+// pack and unpack the code column
+
+inline unsigned char trace_code (unsigned int br_flags, unsigned int opcode) {
+	return (br_flags << 4) | (opcode & 15);
+}
+
+inline unsigned int code_flags (unsigned char code) { return code >> 4; }
+inline unsigned int code_opcode (unsigned char code) { return code & 15; }
+
+struct trace_columns {
+	unsigned long long count;		// number of branches
+	trace_span<unsigned int> address, target;
+	trace_span<unsigned char> code;
+	trace_span<unsigned long long> taken;	// (count + 63) / 64 words
+
+	bool is_taken (unsigned long long i) const {
+		return (taken[i >> 6] >> (i & 63)) & 1;
+	}
+
+	// the mapping backing the spans
+
+	void *map;
+	size_t map_size;
+};
+
+struct trace_columns_header {
+	char		magic[8];	// TRACE_COLUMNS_MAGIC
+	unsigned int	version,	// TRACE_COLUMNS_VERSION
+			source_crc;	// CRC-32 of the trace file
+	unsigned long long source_size,	// size of the trace file in bytes
+			count,		// number of branches
+			address_off,	// file offsets of the columns
+			target_off,
+			code_off,
+			taken_off;
+};
+
+// map the column file for trace file fname from directory dir, building it
+// first by decoding the trace if it is missing or stale.  returns false if
+// the file can't be built or mapped.
+
+bool open_trace_columns (trace_columns *, const char *dir, const char *fname);
+void close_trace_columns (trace_columns *);
+
+#endif // TRACE_COLUMNS_H
@@ -0,0 +1,138 @@
+// trace_index.cc
+// This file contains code for building and reading seekable trace indexes.
+// See trace_index.h for the format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "branch.h"
+#include "trace.h"
+#include "trace_cache.h"
+#include "trace_index.h"
+
+void trace_index_name (char *out, size_t n, const char *fname) {
+	snprintf (out, n, "%s.tidx", fname);
+}
+
+static bool make_header (trace_index_header *h, const char *fname) {
+	memset (h, 0, sizeof (*h));
+	memcpy (h->magic, TRACE_INDEX_MAGIC, sizeof (h->magic));
+	h->version = TRACE_INDEX_VERSION;
+	return trace_file_checksum (fname, &h->source_size, &h->source_crc);
+}
+
+bool build_trace_index (const char *fname, unsigned long long every, unsigned long long *branches) {
+	std::vector<trace_state> checkpoints;
+	trace_index_header h;
+	trace_reader reader;
+	trace block[4096];
+
+	if (every == 0 || !make_header (&h, fname)) return false;
+	h.every = every;
+
+	// decode the whole trace from scratch, stopping at every multiple
+	// of every branches to take a checkpoint
+
+	reader.cache_dir = NULL;
+	reader.seekable = true;
+	reader.open (fname);
+	for (;;) {
+		unsigned long long to_next = every - reader.position () % every;
+		size_t got = reader.next (block, to_next < 4096 ? to_next : 4096);
+		if (!got) break;
+		if (reader.position () % every == 0) {
+			checkpoints.push_back (trace_state ());
+			if (!reader.save (checkpoints.back ())) {
+				fprintf (stderr, "%s: can't checkpoint this trace\n", fname);
+				return false;
+			}
+		}
+	}
+	if (branches) *branches = reader.position ();
+	reader.close ();
+
+	char iname[1000], tmpname[1100];
+	trace_index_name (iname, sizeof (iname), fname);
+	temporary_file_name (tmpname, sizeof (tmpname), iname);
+	FILE *f = fopen (tmpname, "wb");
+	if (!f) {
+		perror (tmpname);
+		return false;
+	}
+	h.count = checkpoints.size ();
+	bool ok = fwrite (&h, sizeof (h), 1, f) == 1;
+	for (size_t i=0; ok && i<checkpoints.size (); i++) {
+		trace_state & s = checkpoints[i];
+		unsigned long long v[5] = { s.branch, s.stream_pos, s.block_bit, s.block_skip, s.decoder.size () };
+		ok = fwrite (v, sizeof (v), 1, f) == 1
+		  && fwrite (s.decoder.data (), 1, s.decoder.size (), f) == s.decoder.size ();
+	}
+	if (fclose (f) != 0) ok = false;
+	if (!ok || rename (tmpname, iname) != 0) {
+		perror (iname);
+		unlink (tmpname);
+		return false;
+	}
+	return true;
+}
+
+bool load_trace_index (const char *fname, std::vector<trace_state> & checkpoints) {
+	char iname[1000];
+	trace_index_header want, h;
+
+	trace_index_name (iname, sizeof (iname), fname);
+	FILE *f = fopen (iname, "rb");
+	if (!f) return false;
+	if (fread (&h, sizeof (h), 1, f) != 1 || !make_header (&want, fname)) {
+		fclose (f);
+		return false;
+	}
+	want.every = h.every;
+	want.count = h.count;
+	if (memcmp (&want, &h, sizeof (h)) != 0) {
+		fprintf (stderr, "%s: stale trace index; ignoring it\n", iname);
+		fclose (f);
+		return false;
+	}
+
+	// don't believe the counts and sizes further than the file goes, so a
+	// corrupt index can't make us allocate more than it holds
+
+	struct stat st;
+	unsigned long long left = 0;
+	if (fstat (fileno (f), &st) == 0 && (unsigned long long) st.st_size > sizeof (h))
+		left = st.st_size - sizeof (h);
+	if (h.count > left / (5 * sizeof (unsigned long long))) {
+		fprintf (stderr, "%s: truncated trace index; ignoring it\n", iname);
+		fclose (f);
+		return false;
+	}
+	checkpoints.resize (h.count);
+	if (h.count == 0) {
+		fclose (f);
+		return true;
+	}
+	for (size_t i=0; i<h.count; i++) {
+		trace_state & s = checkpoints[i];
+		unsigned long long v[5];
+		if (fread (v, sizeof (v), 1, f) != 1 || left < sizeof (v) || v[4] > left - sizeof (v)) break;
+		left -= sizeof (v) + v[4];
+		s.branch = v[0];
+		s.stream_pos = v[1];
+		s.block_bit = v[2];
+		s.block_skip = v[3];
+		s.decoder.resize (v[4]);
+		if (fread (s.decoder.data (), 1, v[4], f) != v[4]) break;
+		if (i + 1 == h.count) {
+			fclose (f);
+			return true;
+		}
+	}
+	fprintf (stderr, "%s: truncated trace index; ignoring it\n", iname);
+	fclose (f);
+	checkpoints.clear ();
+	return false;
+}
@@ -0,0 +1,50 @@
+// trace_index.h
+// This file declares the seekable trace index.  The trace decoder in
+// trace.cc can't start in the middle of a trace because its remember table,
+// LRU time and return address stack depend on every byte before.  An index
+// is a file kept next to the trace (with ".tidx" added to its name) that
+// holds checkpoints taken every so many branches during one full decode.
+// Each checkpoint is a trace_state: where the branch is in the compressed
+// and decompressed data, plus the decoder tables.  trace_reader::open_at
+// uses the index to start decoding at any checkpoint.
+//
+// Like the caches, the index header records the size and CRC-32 of the
+// trace so a stale index is ignored.
+
+#ifndef TRACE_INDEX_H
+#define TRACE_INDEX_H
+
+#include <stddef.h>
+#include <vector>
+
+#define TRACE_INDEX_MAGIC	"CBPTIDX_"
+#define TRACE_INDEX_VERSION	1
+
+struct trace_index_header {
+	char		magic[8];	// TRACE_INDEX_MAGIC
+	unsigned int	version,	// TRACE_INDEX_VERSION
+			source_crc;	// CRC-32 of the trace file
+	unsigned long long source_size,	// size of the trace file in bytes
+			every,		// branches between checkpoints
+			count;		// number of checkpoints that follow
+};
+
+// each checkpoint is stored as the four numbers at the start of a
+// trace_state, the size of its decoder state, and the decoder state
+
+// make the name of the index for trace file fname
+
+void trace_index_name (char *out, size_t n, const char *fname);
+
+// decode the trace file fname and write its index with a checkpoint every
+// every branches, setting *branches (if not NULL) to the length of the
+// trace.  returns false if the trace can't be checkpointed or the index
+// can't be written.
+
+bool build_trace_index (const char *fname, unsigned long long every, unsigned long long *branches = NULL);
+
+// read the index for trace file fname; false if there isn't a current one
+
+bool load_trace_index (const char *fname, std::vector<trace_state> & checkpoints);
+
+#endif // TRACE_INDEX_H
@@ -0,0 +1,101 @@
+// trace_pipeline.cc
+// This file contains the decode thread and ring for trace_pipeline.
+
+#include <time.h>
+
+#include "branch.h"
+#include "trace.h"
+#include "trace_pipeline.h"
+
+static double now_seconds (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// how many times to spin on the ring before giving up the CPU; on a
+// machine with fewer cores than threads, spinning just keeps the other
+// side from running
+
+#define SPINS	100
+
+trace_pipeline::trace_pipeline (void) : 
+	producer_stall_seconds(0), consumer_wait_seconds(0),
+	producer_stalls(0), consumer_waits(0), 
+	head(0), tail(0), stopping(false), running(false) {
+	for (int i=0; i<PIPELINE_SLOTS; i++) {
+		ring[i].traces = new trace[PIPELINE_BLOCK];
+		ring[i].n = 0;
+	}
+}
+
+trace_pipeline::~trace_pipeline (void) {
+	close ();
+	for (int i=0; i<PIPELINE_SLOTS; i++) delete [] ring[i].traces;
+}
+
+void trace_pipeline::open (const char *fname, unsigned long long first) {
+	close ();
+	reader.open_at (fname, first);
+	head = 0;
+	tail = 0;
+	stopping = false;
+	producer_stall_seconds = consumer_wait_seconds = 0;
+	producer_stalls = consumer_waits = 0;
+	running = true;
+	producer = std::thread (&trace_pipeline::produce, this);
+}
+
+// the decode thread: fill the next free slot until the end of the trace,
+// which is marked with an empty block
+
+void trace_pipeline::produce (void) {
+	for (;;) {
+		unsigned long long h = head.load (std::memory_order_relaxed);
+
+		// wait for the consumer to free a slot
+
+		if (h - tail.load (std::memory_order_acquire) == PIPELINE_SLOTS) {
+			double start = now_seconds ();
+			producer_stalls++;
+			for (int spins = 0; h - tail.load (std::memory_order_acquire) == PIPELINE_SLOTS; spins++) {
+				if (stopping.load (std::memory_order_relaxed)) return;
+				if (spins >= SPINS) std::this_thread::yield ();
+			}
+			producer_stall_seconds += now_seconds () - start;
+		}
+		slot & s = ring[h % PIPELINE_SLOTS];
+		s.n = reader.next (s.traces, PIPELINE_BLOCK);
+		head.store (h + 1, std::memory_order_release);
+		if (s.n == 0) return;
+	}
+}
+
+trace *trace_pipeline::acquire (size_t *n) {
+	unsigned long long t = tail.load (std::memory_order_relaxed);
+
+	// wait for the decode thread to fill a slot
+
+	if (head.load (std::memory_order_acquire) == t) {
+		double start = now_seconds ();
+		consumer_waits++;
+		for (int spins = 0; head.load (std::memory_order_acquire) == t; spins++)
+			if (spins >= SPINS) std::this_thread::yield ();
+		consumer_wait_seconds += now_seconds () - start;
+	}
+	slot & s = ring[t % PIPELINE_SLOTS];
+	*n = s.n;
+	return s.n ? s.traces : NULL;
+}
+
+void trace_pipeline::release (void) {
+	tail.store (tail.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void trace_pipeline::close (void) {
+	if (!running) return;
+	stopping = true;
+	producer.join ();
+	reader.close ();
+	running = false;
+}
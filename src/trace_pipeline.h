@@ -0,0 +1,75 @@
+// trace_pipeline.h
+// This file declares trace_pipeline, which decodes a trace on its own
+// thread so that decompression overlaps with whatever consumes the
+// branches.  The decode thread fills blocks of traces and hands them to
+// the consumer through a single-producer/single-consumer ring that uses
+// no locks; each side only waits when the ring is full or empty.
+//
+// The pipeline keeps track of how long each side spent waiting, which
+// shows which stage is the bottleneck: if the consumer waits on an empty
+// ring, decoding is the slow stage; if the decode thread stalls on a full
+// ring, the consumer is.
+
+#ifndef TRACE_PIPELINE_H
+#define TRACE_PIPELINE_H
+
+#include <atomic>
+#include <thread>
+
+#define PIPELINE_SLOTS	8	// blocks in the ring
+#define PIPELINE_BLOCK	4096	// traces per block
+
+class trace_pipeline {
+public:
+	// time and number of times the decode thread found the ring full,
+	// and the consumer found it empty
+
+	double producer_stall_seconds, consumer_wait_seconds;
+	long long int producer_stalls, consumer_waits;
+
+	trace_pipeline (void);
+	~trace_pipeline (void);
+
+	// open a trace file and start decoding it at branch number first
+	// (see trace_reader::open_at)
+
+	void open (const char *fname, unsigned long long first = 0);
+
+	// wait for the next block of traces and return it, setting *n to
+	// the number of traces in it.  returns NULL at the end of the
+	// trace.  the block stays valid until release.
+
+	trace *acquire (size_t *n);
+
+	// give the block returned by acquire back to the decode thread
+
+	void release (void);
+
+	// stop decoding and close the trace file
+
+	void close (void);
+
+private:
+	struct slot {
+		trace *traces;
+		size_t n;	// 0 marks the end of the trace
+	};
+
+	trace_reader reader;
+	slot ring[PIPELINE_SLOTS];
+
+	// blocks written by the producer and read by the consumer, ever.
+	// each is only stored by one side, and they are kept on separate
+	// cache lines so the two threads don't fight over one.
+
+	alignas(64) std::atomic<unsigned long long> head;
+	alignas(64) std::atomic<unsigned long long> tail;
+	alignas(64) std::atomic<bool> stopping;
+
+	std::thread producer;
+	bool running;
+
+	void produce (void);
+};
+
+#endif // TRACE_PIPELINE_H
@@ -0,0 +1,185 @@
+// tracebench.cc
+// This file contains a program that measures how fast traces can be
+// decoded, without running a branch predictor.  For each trace file named
+// on the command line it reads every branch and prints the number of
+// branches, the time taken, and the decode rate in branches per second.
+//
+// -p decompresses through a pipe from ZCAT/BZCAT (see trace.h) instead of
+//    linking the decompressors into the process.
+// -c <dir> reads (and if need be builds) decode-once caches in dir.
+// -C <dir> maps (and if need be builds) columnar traces in dir and walks
+//    just the code and taken columns, counting conditional branches and
+//    how many of them were taken, the way a conditional-only consumer
+//    would.
+// -1 reads one branch per call with trace_reader::next () instead of in
+//    blocks of BLOCK_SIZE.
+// -t <n> decompresses each bzip2 trace with n threads (see bzip2_parallel.h)
+// -x <n> builds an index for each trace with a checkpoint every n branches
+//    (see trace_index.h)
+// -s <first> starts at branch number first, using the index if there is one
+// -n <count> stops after count branches
+// -j <n> decodes n traces at a time on separate threads, each with its own
+//    trace_reader.  per-trace times are then per-thread; the total line
+//    gives the wall-clock time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "branch.h"
+#include "trace.h"
+#include "trace_columns.h"
+#include "trace_index.h"
+
+static double now_seconds (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// count conditional branches and taken conditional branches from the
+// code and taken columns
+
+static void scan_columns (const trace_columns & cols, long long *cond, long long *taken) {
+	long long nc = 0, nt = 0;
+	for (unsigned long long i=0; i<cols.count; i++) {
+		if (code_flags (cols.code[i]) & BR_CONDITIONAL) {
+			nc++;
+			nt += cols.is_taken (i);
+		}
+	}
+	*cond = nc;
+	*taken = nt;
+}
+
+// what we found out about one trace
+
+struct bench_result {
+	long long int branches;
+	double seconds;
+	long long int conditional, taken;
+};
+
+static const char *columns_dir = NULL;
+static bool one_at_a_time = false;
+static unsigned long long index_every = 0, first_branch = 0, max_branches = ~0ULL;
+
+// branches per call in batched mode
+
+#define BLOCK_SIZE	4096
+
+// decode one trace and time it
+
+static void bench (const char *fname, bench_result *r) {
+	double start = now_seconds ();
+	long long int n = 0;
+
+	r->conditional = r->taken = -1;
+	if (index_every) {
+		unsigned long long len;
+		if (!build_trace_index (fname, index_every, &len)) exit (1);
+		n = len;
+	} else if (columns_dir) {
+		trace_columns cols;
+
+		if (!open_trace_columns (&cols, columns_dir, fname)) {
+			fprintf (stderr, "%s: can't open columns\n", fname);
+			exit (1);
+		}
+
+		// don't count building the column file
+
+		start = now_seconds ();
+		scan_columns (cols, &r->conditional, &r->taken);
+		n = cols.count;
+		close_trace_columns (&cols);
+	} else {
+		trace_reader reader;
+		reader.open_at (fname, first_branch);
+		if (one_at_a_time)
+			while ((unsigned long long) n < max_branches && reader.next ()) n++;
+		else {
+			std::vector<trace> block (BLOCK_SIZE);
+			size_t got;
+			while ((unsigned long long) n < max_branches
+			    && (got = reader.next (block.data (), std::min ((unsigned long long) BLOCK_SIZE, max_branches - n))) > 0) 
+				n += got;
+		}
+		reader.close ();
+	}
+	r->branches = n;
+	r->seconds = now_seconds () - start;
+}
+
+int main (int argc, char *argv[]) {
+	int c, jobs = 1;
+
+	while ((c = getopt (argc, argv, "1pc:C:t:x:s:n:j:")) != -1) {
+		switch (c) {
+		case '1': one_at_a_time = true; break;
+		case 'p': trace_pipe = true; break;
+		case 'c': trace_cache_dir = optarg; break;
+		case 'C': columns_dir = optarg; break;
+		case 't': trace_threads = atoi (optarg); break;
+		case 'x': index_every = strtoull (optarg, NULL, 0); break;
+		case 's': first_branch = strtoull (optarg, NULL, 0); break;
+		case 'n': max_branches = strtoull (optarg, NULL, 0); break;
+		case 'j': jobs = atoi (optarg); break;
+		default: 
+			fprintf (stderr, "Usage: %s [-1] [-p] [-c cachedir] [-C columndir] [-t threads] [-x every] [-s first] [-n count] [-j jobs] <filename>...\n", argv[0]);
+			exit (1);
+		}
+	}
+	if (optind == argc || jobs < 1) {
+		fprintf (stderr, "Usage: %s [-1] [-p] [-c cachedir] [-C columndir] [-t threads] [-x every] [-s first] [-n count] [-j jobs] <filename>...\n", argv[0]);
+		exit (1);
+	}
+
+	int ntraces = argc - optind;
+	std::vector<bench_result> results (ntraces);
+	std::atomic<int> next_trace (0);
+	double start = now_seconds ();
+
+	// each worker takes the next trace nobody has started yet
+
+	auto worker = [&] (void) {
+		int i;
+		while ((i = next_trace++) < ntraces)
+			bench (argv[optind + i], &results[i]);
+	};
+	if (jobs == 1)
+		worker ();
+	else {
+		std::vector<std::thread> threads;
+		for (int j=0; j<jobs; j++) threads.push_back (std::thread (worker));
+		for (auto & t : threads) t.join ();
+	}
+	double wall = now_seconds () - start;
+
+	long long int all_branches = 0;
+	double all_seconds = 0;
+
+	for (int i=0; i<ntraces; i++) {
+		bench_result & r = results[i];
+		if (r.conditional >= 0)
+			printf ("%-40s\t%10lld conditional %10lld taken\n", argv[optind + i], r.conditional, r.taken);
+		printf ("%-40s\t%10lld branches %8.3f s %12.0f branches/s\n", 
+			argv[optind + i], r.branches, r.seconds, r.branches / r.seconds);
+		all_branches += r.branches;
+		all_seconds += r.seconds;
+	}
+
+	// with more than one job the traces overlap, so use the wall clock
+
+	if (jobs > 1) all_seconds = wall;
+	if (ntraces > 1)
+		printf ("%-40s\t%10lld branches %8.3f s %12.0f branches/s\n", 
+			"total", all_branches, all_seconds, all_branches / all_seconds);
+	return 0;
+}